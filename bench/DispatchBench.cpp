@@ -0,0 +1,124 @@
+#include "Server.hpp"
+#include "Commands.hpp"
+#include <sys/time.h>
+#include <deque>
+#include <map>
+
+// Measures the cost of handing one line to the command layer, output
+// generation included, on a registered client that sits in one channel.
+// The same lines then go through a dispatcher built per line, the way every
+// line was handled before the server kept one, so the two can be compared.
+
+static const long ITERATIONS = 500000;
+
+static const char *lines[] =
+{
+	"PRIVMSG #bench :hello there",
+	"TOPIC #bench",
+	"MODE #bench +t",
+	"PRIVMSG bench :echo",
+	"NOSUCH command"
+};
+
+// What the old per-line path paid on top of the dispatch itself: a fresh
+// Commands, and the handler table keyed by name its constructor filled in
+// and searched with a std::string.
+static bool dispatchPerLine(Server& server, const serverConfig& config, Client& client, const std::string& line)
+{
+	std::map<std::string, int> table;
+	for (int c = 0; c < Metrics::CMD_UNKNOWN; c++)
+		table[Metrics::COMMAND_NAMES[c]] = c;
+
+	ircMessage msg;
+	if (!Parser::parse(line.data(), line.size(), msg))
+		return false;
+	Commands *commands = server.makeCommands(config);
+	bool known = table.find(std::string(msg.command.data, msg.command.size)) != table.end();
+	commands->executeCommand(msg, line.size(), client);
+	delete commands;
+	return known;
+}
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int ac, char **av)
+{
+	serverConfig config;
+	config.port = (ac > 1) ? av[1] : "16667";
+	config.pwd = "pw";
+	config.backend = "poll";
+	config.serverName = "server";
+	config.services = true;
+	config.logLevel = Logger::WARN;
+	config.traceEvents = 0;
+	config.sendqLimit = 1 << 30;
+	config.threads = 1;
+	config.backlog = 16;
+	config.acceptBudget = 16;
+
+	try
+	{
+		Server server(config);
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1)
+			throw std::runtime_error("socketpair failed");
+
+		server.lockState(&server.getShard(0));
+		Client *client = server.registerClient(pair[0], 0);
+		server.handleClientMessage(*client, "PASS pw");
+		server.handleClientMessage(*client, "NICK bench");
+		server.handleClientMessage(*client, "USER bench 0 * :Bench");
+		server.handleClientMessage(*client, "JOIN #bench");
+
+		const size_t count = sizeof(lines) / sizeof(lines[0]);
+		std::vector<std::string> input(lines, lines + count);
+		std::deque<MessageBuffer> sink;
+
+		double start = now();
+		for (long i = 0; i < ITERATIONS; i++)
+		{
+			server.handleClientMessage(*client, input[i % count]);
+			if ((i & 255) == 0)
+			{
+				client->takeSendQueue(sink);
+				sink.clear();
+			}
+		}
+		double elapsed = now() - start;
+
+		// Services stay with the server's own dispatcher; a second bot per
+		// line would only collide on its nickname.
+		serverConfig perLine = config;
+		perLine.services = false;
+		long known = 0;
+		start = now();
+		for (long i = 0; i < ITERATIONS; i++)
+		{
+			known += dispatchPerLine(server, perLine, *client, input[i % count]);
+			if ((i & 255) == 0)
+			{
+				client->takeSendQueue(sink);
+				sink.clear();
+			}
+		}
+		double perLineElapsed = now() - start;
+		server.unlockState();
+		close(pair[1]);
+
+		std::cout << "dispatch: " << ITERATIONS << " lines, "
+			<< elapsed * 1e9 / ITERATIONS << " ns/line" << std::endl;
+		std::cout << "dispatch-per-line-commands: " << ITERATIONS << " lines, "
+			<< perLineElapsed * 1e9 / ITERATIONS << " ns/line (" << known << " known)" << std::endl;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return (1);
+	}
+	return (0);
+}
@@ -0,0 +1,102 @@
+#include "Server.hpp"
+#include <sys/time.h>
+#include <deque>
+
+// A join storm: clients join one channel back to back until it has 10000
+// members. Every join is announced to all members and answered with the
+// NAMES list, so a join costs time proportional to the channel size; the
+// ns/member column should stay flat as the channel grows. Clients use
+// descriptor numbers that are never opened, as in NickBench.
+
+static const int FAKE_FD_BASE = 1 << 20;
+static const int MEMBERS = 10000;
+static const int WINDOW = 500;
+static const int REPORT = 2500;
+static const long NAMES_ITERATIONS = 2000;
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void drain(std::vector<Client *>& clients, std::deque<MessageBuffer>& sink)
+{
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		clients[i]->takeSendQueue(sink);
+		sink.clear();
+	}
+}
+
+int main(int ac, char **av)
+{
+	serverConfig config;
+	config.port = (ac > 1) ? av[1] : "16669";
+	config.pwd = "pw";
+	config.backend = "poll";
+	config.serverName = "server";
+	config.services = true;
+	config.logLevel = Logger::WARN;
+	config.traceEvents = 0;
+	config.sendqLimit = 1 << 30;
+	config.threads = 1;
+	config.backlog = 16;
+	config.acceptBudget = 16;
+
+	try
+	{
+		Server server(config);
+		std::vector<Client *> registered;
+		std::deque<MessageBuffer> sink;
+
+		server.lockState(&server.getShard(0));
+		for (int i = 0; i < MEMBERS; i++)
+		{
+			Client *client = server.registerClient(FAKE_FD_BASE + i, 0);
+			server.handleClientMessage(*client, "PASS pw");
+			server.handleClientMessage(*client, "NICK joiner" + ft_itoa(i));
+			server.handleClientMessage(*client, "USER u 0 * :Bench");
+			registered.push_back(client);
+		}
+		drain(registered, sink);
+
+		double reportTime = 0;
+		for (int joined = 0; joined < MEMBERS; joined += WINDOW)
+		{
+			double start = now();
+			for (int i = joined; i < joined + WINDOW; i++)
+				server.handleClientMessage(*registered[i], "JOIN #storm");
+			reportTime += now() - start;
+			drain(registered, sink);
+
+			int done = joined + WINDOW;
+			if (done % REPORT == 0)
+			{
+				double perJoin = reportTime * 1e9 / REPORT;
+				std::cout << "join-storm: " << done - REPORT << "-" << done << " members, "
+					<< perJoin << " ns/join, " << perJoin / (done - REPORT / 2) << " ns/member" << std::endl;
+				reportTime = 0;
+			}
+		}
+
+		double start = now();
+		for (long i = 0; i < NAMES_ITERATIONS; i++)
+		{
+			server.handleClientMessage(*registered[0], "NAMES #storm");
+			registered[0]->takeSendQueue(sink);
+			sink.clear();
+		}
+		double elapsed = now() - start;
+		std::cout << "names: " << MEMBERS << " members, "
+			<< elapsed * 1e9 / NAMES_ITERATIONS << " ns/request" << std::endl;
+		server.unlockState();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return (1);
+	}
+	return (0);
+}
@@ -0,0 +1,655 @@
+#include "Reactor.hpp"
+#include "LineBuffer.hpp"
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Load generator for a running ircserv. Opens many non-blocking connections,
+// registers them, puts them into channels of a fixed size and then drives a
+// mix of PRIVMSG, JOIN (a PART and re-JOIN), NICK and QUIT (a reconnect) at
+// a target rate. Every PRIVMSG carries its send time, so each copy a channel
+// member receives yields one end-to-end delivery latency.
+//
+//   ./bench/LoadGen <port> <password> [--host=127.0.0.1] [--clients=1000]
+//       [--channel-size=50] [--rate=5000] [--duration=10] [--size=64]
+//       [--mix=privmsg:94,join:2,nick:2,quit:2] [--backend=epoll|poll]
+
+#define RED "\033[1;31m"
+#define RESET "\033[0m"
+
+static const char *MARKER = ":lg ";
+static const int HANDSHAKE_WINDOW = 256;
+static const int SETUP_TIMEOUT = 60;
+static const int DRAIN_MS = 1000;
+
+struct loadConfig
+{
+	std::string	host;
+	int			port;
+	std::string	pwd;
+	std::string	backend;
+	int			clients;
+	int			channelSize;
+	long		rate;
+	double		duration;
+	size_t		size;
+	int			mix[4];
+};
+
+enum action
+{
+	PRIVMSG,
+	JOIN,
+	NICK,
+	QUIT
+};
+
+static const char *ACTION_NAMES[] = { "privmsg", "join", "nick", "quit" };
+
+enum clientState
+{
+	IDLE,
+	CONNECTING,
+	REGISTERING,
+	JOINING,
+	READY,
+	QUITTING
+};
+
+struct loadClient
+{
+	int				index;
+	int				fd;
+	clientState		state;
+	unsigned		nickGen;
+	LineBuffer		input;
+	std::string		output;
+	bool			wantsWrite;
+};
+
+// Latencies in nanoseconds, bucketed log-linearly: 16 buckets per power of
+// two, so a percentile is accurate to about 6% whatever its magnitude.
+class latencyHistogram
+{
+	private:
+			static const int	SUB = 16;
+			static const int	BUCKETS = 64 * SUB;
+
+			unsigned long long	counts[BUCKETS];
+			unsigned long long	total;
+			long long			max;
+
+			static int bucketOf(long long ns)
+			{
+				if (ns < SUB)
+					return ns < 0 ? 0 : static_cast<int>(ns);
+				int exp = 63 - __builtin_clzll(static_cast<unsigned long long>(ns));
+				int sub = static_cast<int>((ns >> (exp - 4)) & (SUB - 1));
+				return (exp - 3) * SUB + sub;
+			}
+
+			static long long lowerBound(int bucket)
+			{
+				if (bucket < SUB)
+					return bucket;
+				int exp = bucket / SUB + 3;
+				return (static_cast<long long>(SUB + bucket % SUB)) << (exp - 4);
+			}
+
+	public:
+			latencyHistogram() : total(0), max(0)
+			{
+				std::memset(counts, 0, sizeof(counts));
+			}
+
+			void record(long long ns)
+			{
+				counts[bucketOf(ns)]++;
+				total++;
+				if (ns > max)
+					max = ns;
+			}
+
+			unsigned long long count() const
+			{
+				return total;
+			}
+
+			long long percentile(double p) const
+			{
+				unsigned long long rank = static_cast<unsigned long long>(p * total);
+				unsigned long long seen = 0;
+				for (int i = 0; i < BUCKETS; i++)
+				{
+					seen += counts[i];
+					if (seen > rank)
+						return lowerBound(i);
+				}
+				return max;
+			}
+
+			long long getMax() const
+			{
+				return max;
+			}
+};
+
+struct loadStats
+{
+	unsigned long		sent[4];
+	unsigned long		delivered;
+	unsigned long long	bytesIn;
+	unsigned long		reconnects;
+	unsigned long		errors;
+	latencyHistogram	latency;
+};
+
+static long long monotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static std::string toStr(long value)
+{
+	std::ostringstream out;
+	out << value;
+	return out.str();
+}
+
+static long parseNumber(const std::string& value, const std::string& opt)
+{
+	char *end = NULL;
+	long num = std::strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0' || num <= 0)
+		throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+	return num;
+}
+
+// "privmsg:94,join:2,nick:2,quit:2"; actions left out get weight 0.
+static void parseMix(const std::string& value, int mix[4])
+{
+	std::memset(mix, 0, 4 * sizeof(int));
+	std::stringstream in(value);
+	std::string item;
+	while (std::getline(in, item, ','))
+	{
+		std::string::size_type colon = item.find(':');
+		std::string name = item.substr(0, colon);
+		int a = 0;
+		while (a < 4 && name != ACTION_NAMES[a])
+			a++;
+		if (a == 4 || colon == std::string::npos)
+			throw std::invalid_argument(RED"Invalid value for --mix: " + value + RESET);
+		char *end = NULL;
+		long weight = std::strtol(item.c_str() + colon + 1, &end, 10);
+		if (*end != '\0' || weight < 0)
+			throw std::invalid_argument(RED"Invalid value for --mix: " + value + RESET);
+		mix[a] = static_cast<int>(weight);
+	}
+	if (mix[PRIVMSG] + mix[JOIN] + mix[NICK] + mix[QUIT] == 0)
+		throw std::invalid_argument(RED"Invalid value for --mix: " + value + RESET);
+}
+
+static loadConfig parseArgs(int ac, char **av)
+{
+	if (ac < 3)
+		throw std::invalid_argument(RED"Usage: " + std::string(av[0]) + " port password [--host=addr] [--clients=n] [--channel-size=n]"
+			" [--rate=msgs/s] [--duration=s] [--size=bytes] [--mix=privmsg:n,join:n,nick:n,quit:n] [--backend=epoll|poll]" RESET);
+
+	loadConfig config;
+	config.port = static_cast<int>(parseNumber(av[1], "port"));
+	config.pwd = av[2];
+	config.host = "127.0.0.1";
+#ifdef __linux__
+	config.backend = "epoll";
+#else
+	config.backend = "poll";
+#endif
+	config.clients = 1000;
+	config.channelSize = 50;
+	config.rate = 5000;
+	config.duration = 10;
+	config.size = 64;
+	parseMix("privmsg:94,join:2,nick:2,quit:2", config.mix);
+
+	for (int i = 3; i < ac; i++)
+	{
+		std::string opt = av[i];
+		std::string::size_type eq = opt.find('=');
+		std::string key = opt.substr(0, eq);
+		std::string value = (eq == std::string::npos) ? "" : opt.substr(eq + 1);
+
+		if (key == "--host" && !value.empty())
+			config.host = value;
+		else if (key == "--backend" && !value.empty())
+			config.backend = value;
+		else if (key == "--clients")
+			config.clients = static_cast<int>(parseNumber(value, key));
+		else if (key == "--channel-size")
+			config.channelSize = static_cast<int>(parseNumber(value, key));
+		else if (key == "--rate")
+			config.rate = parseNumber(value, key);
+		else if (key == "--duration")
+			config.duration = parseNumber(value, key);
+		else if (key == "--size")
+			config.size = parseNumber(value, key);
+		else if (key == "--mix")
+			parseMix(value, config.mix);
+		else
+			throw std::invalid_argument(RED"Unknown option: " + opt + RESET);
+	}
+	if (config.size > 400)
+		config.size = 400;
+	return config;
+}
+
+static void raiseFdLimit()
+{
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == limit.rlim_max)
+		return;
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+class LoadGen
+{
+	private:
+			loadConfig					config;
+			Reactor						*reactor;
+			std::vector<loadClient>		clients;
+			std::vector<int>			reconnect;
+			struct sockaddr_in			addr;
+			int							handshaking;
+			int							ready;
+			bool						measuring;
+			loadStats					stats;
+			std::string					padding;
+
+			std::string channelOf(const loadClient& client) const
+			{
+				return "#load" + toStr(client.index / config.channelSize);
+			}
+
+			std::string nickOf(const loadClient& client) const
+			{
+				if (client.nickGen == 0)
+					return "lg" + toStr(client.index);
+				return "lg" + toStr(client.index) + "x" + toStr(client.nickGen);
+			}
+
+			void setState(loadClient& client, clientState state)
+			{
+				bool wasHandshaking = client.state == CONNECTING || client.state == REGISTERING || client.state == JOINING;
+				bool isHandshaking = state == CONNECTING || state == REGISTERING || state == JOINING;
+				handshaking += static_cast<int>(isHandshaking) - static_cast<int>(wasHandshaking);
+				ready += static_cast<int>(state == READY) - static_cast<int>(client.state == READY);
+				client.state = state;
+			}
+
+			void updateInterest(loadClient& client)
+			{
+				bool wantsWrite = client.state == CONNECTING || !client.output.empty();
+				if (wantsWrite == client.wantsWrite)
+					return;
+				reactor->modify(client.fd, Reactor::READ | (wantsWrite ? Reactor::WRITE : 0), &client);
+				client.wantsWrite = wantsWrite;
+			}
+
+			void send(loadClient& client, const std::string& line)
+			{
+				client.output += line;
+				client.output += "\r\n";
+				if (client.state != CONNECTING)
+					flush(client);
+			}
+
+			void flush(loadClient& client)
+			{
+				while (!client.output.empty())
+				{
+					ssize_t n = ::send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+					if (n > 0)
+					{
+						client.output.erase(0, n);
+						continue;
+					}
+					if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+						break;
+					drop(client, true);
+					return;
+				}
+				// The server keeps the connection after QUIT, so the
+				// client hangs up once the QUIT is out and reconnects when
+				// the server closes its side.
+				if (client.output.empty() && client.state == QUITTING)
+					shutdown(client.fd, SHUT_WR);
+				updateInterest(client);
+			}
+
+			void connect(loadClient& client)
+			{
+				client.fd = socket(AF_INET, SOCK_STREAM, 0);
+				if (client.fd == -1)
+					throw std::runtime_error(RED"socket: " + std::string(strerror(errno)) + RESET);
+				fcntl(client.fd, F_SETFL, O_NONBLOCK);
+				int one = 1;
+				setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				if (::connect(client.fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1 && errno != EINPROGRESS)
+					throw std::runtime_error(RED"connect: " + std::string(strerror(errno)) + RESET);
+
+				client.input.clear();
+				client.output.clear();
+				client.wantsWrite = true;
+				setState(client, CONNECTING);
+				reactor->add(client.fd, Reactor::READ | Reactor::WRITE, &client);
+				send(client, "PASS " + config.pwd);
+				send(client, "NICK " + nickOf(client));
+				send(client, "USER lg 0 * :load generator");
+			}
+
+			// Closes the socket; clients that were quitting on purpose, or
+			// any client once setup is over, come back through reconnect.
+			void drop(loadClient& client, bool error)
+			{
+				if (client.state == IDLE)
+					return;
+				if (error)
+					stats.errors++;
+				reactor->remove(client.fd);
+				close(client.fd);
+				client.fd = -1;
+				setState(client, IDLE);
+				reconnect.push_back(client.index);
+			}
+
+			void handleLine(loadClient& client, const lineView& line, long long now)
+			{
+				const char *data = line.data;
+				const char *end = data + line.size;
+				const char *cmd = data;
+				if (cmd < end && *cmd == ':')
+				{
+					cmd = static_cast<const char *>(std::memchr(cmd, ' ', end - cmd));
+					if (cmd == NULL)
+						return;
+					cmd++;
+				}
+				size_t len = end - cmd;
+
+				if (len >= 8 && std::memcmp(cmd, "PRIVMSG ", 8) == 0)
+				{
+					const char *marker = std::search(cmd, end, MARKER, MARKER + 4);
+					if (marker != end)
+					{
+						long long sentAt = std::strtoll(marker + 4, NULL, 10);
+						stats.delivered++;
+						stats.latency.record(now - sentAt);
+					}
+				}
+				else if (len >= 4 && std::memcmp(cmd, "001 ", 4) == 0 && client.state == REGISTERING)
+				{
+					setState(client, JOINING);
+					send(client, "JOIN " + channelOf(client));
+				}
+				else if (len >= 4 && std::memcmp(cmd, "366 ", 4) == 0 && client.state == JOINING)
+					setState(client, READY);
+				else if (len >= 4 && std::memcmp(cmd, "433 ", 4) == 0)
+					stats.errors++;
+				else if (len >= 5 && std::memcmp(cmd, "ERROR", 5) == 0 && client.state != QUITTING)
+					stats.errors++;
+			}
+
+			void handleRead(loadClient& client)
+			{
+				for (;;)
+				{
+					size_t room = client.input.reserve();
+					ssize_t n = recv(client.fd, client.input.writePtr(), room, 0);
+					if (n == 0)
+					{
+						drop(client, client.state != QUITTING);
+						return;
+					}
+					if (n == -1)
+					{
+						if (errno != EAGAIN && errno != EWOULDBLOCK)
+							drop(client, client.state != QUITTING);
+						return;
+					}
+					client.input.commit(n);
+					if (measuring)
+						stats.bytesIn += n;
+
+					long long now = monotonicNs();
+					lineView line;
+					while (client.state != IDLE && client.input.nextLine(line))
+						handleLine(client, line, now);
+					if (client.state == IDLE || static_cast<size_t>(n) < room)
+						return;
+				}
+			}
+
+			void handleEvent(const reactorEvent& event)
+			{
+				loadClient& client = *static_cast<loadClient *>(event.data);
+				if (client.state == IDLE)
+					return;
+				if (client.state == CONNECTING && (event.writable || event.hangup))
+				{
+					int err = 0;
+					socklen_t errLen = sizeof(err);
+					getsockopt(client.fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+					if (err != 0)
+					{
+						drop(client, true);
+						return;
+					}
+					setState(client, REGISTERING);
+				}
+				if (event.writable)
+					flush(client);
+				if (client.state != IDLE && (event.readable || event.hangup))
+					handleRead(client);
+			}
+
+			void startReconnects()
+			{
+				while (!reconnect.empty() && handshaking < HANDSHAKE_WINDOW)
+				{
+					loadClient& client = clients[reconnect.back()];
+					reconnect.pop_back();
+					if (measuring)
+						stats.reconnects++;
+					connect(client);
+				}
+			}
+
+			void poll(int timeout)
+			{
+				std::vector<reactorEvent> events;
+				startReconnects();
+				reactor->wait(events, timeout);
+				for (size_t i = 0; i < events.size(); ++i)
+					handleEvent(events[i]);
+			}
+
+			action pickAction()
+			{
+				int total = config.mix[PRIVMSG] + config.mix[JOIN] + config.mix[NICK] + config.mix[QUIT];
+				int roll = std::rand() % total;
+				int a = 0;
+				while (roll >= config.mix[a])
+					roll -= config.mix[a++];
+				return static_cast<action>(a);
+			}
+
+			// Fires one action from a random client that is ready; returns
+			// false if none could be found quickly.
+			bool fire(long long now)
+			{
+				for (int attempt = 0; attempt < 8; attempt++)
+				{
+					loadClient& client = clients[std::rand() % clients.size()];
+					if (client.state != READY)
+						continue;
+
+					action a = pickAction();
+					stats.sent[a]++;
+					switch (a)
+					{
+						case PRIVMSG:
+							send(client, "PRIVMSG " + channelOf(client) + " " + MARKER + toStr(now) + " " + padding);
+							break;
+						case JOIN:
+							setState(client, JOINING);
+							send(client, "PART " + channelOf(client));
+							send(client, "JOIN " + channelOf(client));
+							break;
+						case NICK:
+							client.nickGen++;
+							send(client, "NICK " + nickOf(client));
+							break;
+						case QUIT:
+							setState(client, QUITTING);
+							send(client, "QUIT :load generator");
+							break;
+					}
+					return true;
+				}
+				return false;
+			}
+
+	public:
+			LoadGen(const loadConfig& config) : config(config), reactor(Reactor::create(config.backend)),
+				handshaking(0), ready(0), measuring(false)
+			{
+				std::memset(stats.sent, 0, sizeof(stats.sent));
+				stats.delivered = 0;
+				stats.bytesIn = 0;
+				stats.reconnects = 0;
+				stats.errors = 0;
+				padding.assign(config.size, 'x');
+
+				std::memset(&addr, 0, sizeof(addr));
+				addr.sin_family = AF_INET;
+				addr.sin_port = htons(config.port);
+				if (inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr) != 1)
+					throw std::invalid_argument(RED"Invalid host: " + config.host + RESET);
+
+				clients.resize(config.clients);
+				for (int i = config.clients - 1; i >= 0; i--)
+				{
+					clients[i].index = i;
+					clients[i].fd = -1;
+					clients[i].state = IDLE;
+					clients[i].nickGen = 0;
+					clients[i].wantsWrite = false;
+					reconnect.push_back(i);
+				}
+			}
+
+			~LoadGen()
+			{
+				for (size_t i = 0; i < clients.size(); ++i)
+					if (clients[i].fd != -1)
+						close(clients[i].fd);
+				delete reactor;
+			}
+
+			void run()
+			{
+				long long start = monotonicNs();
+				while (ready < config.clients)
+				{
+					poll(10);
+					if (monotonicNs() - start > SETUP_TIMEOUT * 1000000000LL)
+						throw std::runtime_error(RED"Setup timed out with " + toStr(ready) + " clients ready" RESET);
+				}
+				double setup = (monotonicNs() - start) / 1e9;
+				std::cout << "loadgen: " << config.clients << " clients registered and joined in " << setup << " s, "
+					<< (config.clients + config.channelSize - 1) / config.channelSize << " channels of " << config.channelSize << std::endl;
+
+				measuring = true;
+				start = monotonicNs();
+				long long stop = start + static_cast<long long>(config.duration * 1e9);
+				unsigned long fired = 0;
+				unsigned long missed = 0;
+				long long now = start;
+				while (now < stop)
+				{
+					unsigned long due = static_cast<unsigned long>((now - start) / 1e9 * config.rate);
+					while (fired < due)
+					{
+						if (!fire(now))
+							missed++;
+						fired++;
+					}
+					poll(1);
+					now = monotonicNs();
+				}
+				double elapsed = (now - start) / 1e9;
+
+				long long drainUntil = monotonicNs() + DRAIN_MS * 1000000LL;
+				while (monotonicNs() < drainUntil)
+					poll(10);
+				measuring = false;
+
+				report(elapsed, missed);
+			}
+
+			void report(double elapsed, unsigned long missed) const
+			{
+				unsigned long total = 0;
+				std::cout << "sent:";
+				for (int a = 0; a < 4; a++)
+				{
+					std::cout << " " << ACTION_NAMES[a] << " " << stats.sent[a];
+					total += stats.sent[a];
+				}
+				std::cout << " (" << total / elapsed << " commands/s, " << missed << " skipped, no client ready)" << std::endl;
+				std::cout << "delivered: " << stats.delivered << " messages, " << stats.delivered / elapsed << " msg/s, "
+					<< stats.bytesIn / elapsed / 1e6 << " MB/s fanout" << std::endl;
+				std::cout << "latency: p50 " << stats.latency.percentile(0.50) / 1e3 << " us, p99 "
+					<< stats.latency.percentile(0.99) / 1e3 << " us, p999 " << stats.latency.percentile(0.999) / 1e3
+					<< " us, max " << stats.latency.getMax() / 1e3 << " us" << std::endl;
+				std::cout << "reconnects: " << stats.reconnects << ", errors: " << stats.errors << std::endl;
+			}
+};
+
+int main(int ac, char **av)
+{
+	try
+	{
+		loadConfig config = parseArgs(ac, av);
+		signal(SIGPIPE, SIG_IGN);
+		raiseFdLimit();
+		LoadGen gen(config);
+		gen.run();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return (1);
+	}
+	return (0);
+}
@@ -0,0 +1,386 @@
+#include "Server.hpp"
+#include <sys/time.h>
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+
+// Hot paths timed on their own: parsing, input framing, target lists,
+// command dispatch, metrics recording and channel fanout. Each case reports ns/op and heap
+// allocations per op (every allocation goes through the counting operator
+// new below) and is compared with bench/baseline.txt. Its time is the median
+// of REPEATS runs. More allocations than the baseline fail the run. A median
+// over SLOWER_BY times the baseline is measured again up to RETRIES times
+// and fails the run only if every attempt stays over it; SLOWER_BY sits above
+// the spread seen between runs of an unchanged tree.
+//
+//   ./bench/MicroBench [baseline]          compare
+//   ./bench/MicroBench --save [baseline]   rewrite the baseline
+
+static const char *DEFAULT_BASELINE = "bench/baseline.txt";
+static const double SLOWER_BY = 2.0;
+static const int REPEATS = 9;
+static const int RETRIES = 2;
+static const int FAKE_FD_BASE = 1 << 20;
+static const int FANOUT_SIZES[] = { 10, 100, 1000 };
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) throw(std::bad_alloc)
+{
+	allocations++;
+	void *p = std::malloc(size == 0 ? 1 : size);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) throw()
+{
+	std::free(p);
+}
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct benchResult
+{
+	double	ns;
+	double	allocs;
+};
+
+// A case runs its operation `iterations` times and returns how many
+// operations that was (fanout counts one op per message, not per copy).
+typedef long (*benchFunction)(long iterations);
+
+static benchResult measure(benchFunction fn, long iterations)
+{
+	benchResult result;
+	double times[REPEATS];
+	result.allocs = 0;
+
+	fn(iterations / 10);
+	for (int r = 0; r < REPEATS; r++)
+	{
+		unsigned long before = allocations;
+		double start = now();
+		long ops = fn(iterations);
+		double elapsed = now() - start;
+		times[r] = elapsed * 1e9 / ops;
+		result.allocs = static_cast<double>(allocations - before) / ops;
+	}
+	std::sort(times, times + REPEATS);
+	result.ns = times[REPEATS / 2];
+	return result;
+}
+
+// Parser
+
+static volatile size_t keep = 0; // results go here so the work is not optimised away
+
+static long parsePrivmsg(long iterations)
+{
+	static const char line[] = ":nick!user@host.example.net PRIVMSG #channel :hello there, how is everyone doing";
+	ircMessage msg;
+	for (long i = 0; i < iterations; i++)
+	{
+		Parser::parse(line, sizeof(line) - 1, msg);
+		keep += msg.paramCount;
+	}
+	return iterations;
+}
+
+static long parseTagged(long iterations)
+{
+	static const char line[] = "@time=2024-01-01T00:00:00.000Z;msgid=abc123;+draft/reply=xyz PRIVMSG #channel :tagged";
+	ircMessage msg;
+	for (long i = 0; i < iterations; i++)
+	{
+		Parser::parse(line, sizeof(line) - 1, msg);
+		keep += msg.paramCount;
+	}
+	return iterations;
+}
+
+static long parseMode(long iterations)
+{
+	static const char line[] = "MODE #channel +klo-it secret 25 someone";
+	ircMessage msg;
+	for (long i = 0; i < iterations; i++)
+	{
+		Parser::parse(line, sizeof(line) - 1, msg);
+		keep += msg.paramCount;
+	}
+	return iterations;
+}
+
+// Eight pipelined lines arrive per read; one op is one line handed out.
+static long framePipelined(long iterations)
+{
+	static const char chunk[] =
+		"PRIVMSG #a :one\r\nPRIVMSG #b :two\r\nPING :token\r\nPRIVMSG bob :three\r\n"
+		"MODE #a +t\r\nTOPIC #a :new topic\r\nPRIVMSG #c :four\r\nPRIVMSG #d :five\r\n";
+	LineBuffer input;
+	lineView line;
+	long lines = 0;
+	while (lines < iterations)
+	{
+		input.reserve();
+		std::memcpy(input.writePtr(), chunk, sizeof(chunk) - 1);
+		input.commit(sizeof(chunk) - 1);
+		while (input.nextLine(line))
+			lines++;
+	}
+	return lines;
+}
+
+static long splitTargets(long iterations)
+{
+	static const char list[] = "#alpha,#beta,#gamma,#delta,nick1,nick2,#epsilon,#zeta";
+	lineView view;
+	view.data = list;
+	view.size = sizeof(list) - 1;
+	lineView item;
+	long items = 0;
+	while (items < iterations)
+	{
+		size_t pos = 0;
+		while (nextItem(view, pos, item))
+		{
+			keep += item.size;
+			items++;
+		}
+	}
+	return items;
+}
+
+// Command layer
+
+static Server *server = NULL;
+static std::vector<Client *> members;
+static std::deque<MessageBuffer> sink;
+
+static void drain()
+{
+	for (size_t i = 0; i < members.size(); i++)
+	{
+		members[i]->takeSendQueue(sink);
+		sink.clear();
+	}
+}
+
+static void addMembers(size_t count)
+{
+	while (members.size() < count)
+	{
+		int i = members.size();
+		Client *client = server->registerClient(FAKE_FD_BASE + i, 0);
+		server->handleClientMessage(*client, "PASS pw");
+		server->handleClientMessage(*client, "NICK m" + ft_itoa(i));
+		server->handleClientMessage(*client, "USER u 0 * :Bench");
+		if (i == 0)
+			server->handleClientMessage(*client, "JOIN #solo");
+		else
+			server->handleClientMessage(*client, "JOIN #fanout");
+		members.push_back(client);
+	}
+	drain();
+}
+
+static long dispatchLine(const std::string& line, long iterations)
+{
+	for (long i = 0; i < iterations; i++)
+	{
+		server->handleClientMessage(*members[0], line);
+		if ((i & 255) == 255)
+			drain();
+	}
+	drain();
+	return iterations;
+}
+
+static long dispatchPrivmsgChannel(long iterations)
+{
+	return dispatchLine("PRIVMSG #solo :hello there", iterations);
+}
+
+static long dispatchPrivmsgNick(long iterations)
+{
+	return dispatchLine("PRIVMSG m1 :hello there", iterations);
+}
+
+static long dispatchMode(long iterations)
+{
+	return dispatchLine("MODE #solo +t", iterations);
+}
+
+static long dispatchUnknown(long iterations)
+{
+	return dispatchLine("NOSUCH command", iterations);
+}
+
+// What recording costs on the hot path: one histogram update, and the clock
+// read that each timed command pays twice.
+static long metricsObserve(long iterations)
+{
+	Metrics& metrics = server->getMetrics();
+	for (long i = 0; i < iterations; i++)
+		metrics.observeCommand(Metrics::CMD_PRIVMSG, 32, i & 4095);
+	return iterations;
+}
+
+static long metricsClock(long iterations)
+{
+	for (long i = 0; i < iterations; i++)
+		keep += Metrics::nowNs();
+	return iterations;
+}
+
+// members[1..] sit in #fanout, which grows to the size under test before
+// each fanout case.
+static long fanout(long iterations)
+{
+	for (long i = 0; i < iterations; i++)
+	{
+		server->handleClientMessage(*members[1], "PRIVMSG #fanout :fanout message");
+		if ((i & 15) == 15)
+			drain();
+	}
+	drain();
+	return iterations;
+}
+
+struct benchCase
+{
+	const char		*name;
+	benchFunction	fn;
+	long			iterations;
+	size_t			members;
+};
+
+static std::map<std::string, benchResult> loadBaseline(const std::string& path)
+{
+	std::map<std::string, benchResult> baseline;
+	std::ifstream in(path.c_str());
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream fields(line);
+		std::string name;
+		benchResult result;
+		if (fields >> name >> result.ns >> result.allocs)
+			baseline[name] = result;
+	}
+	return baseline;
+}
+
+int main(int ac, char **av)
+{
+	bool save = ac > 1 && std::string(av[1]) == "--save";
+	std::string path = ac > (save ? 2 : 1) ? av[save ? 2 : 1] : DEFAULT_BASELINE;
+
+	serverConfig config;
+	config.port = "16670";
+	config.pwd = "pw";
+	config.backend = "poll";
+	config.serverName = "server";
+	config.services = false;
+	config.logLevel = Logger::WARN;
+	config.traceEvents = 0;
+	config.sendqLimit = 1 << 30;
+	config.threads = 1;
+	config.backlog = 16;
+	config.acceptBudget = 16;
+
+	std::vector<benchCase> cases;
+	benchCase fixed[] =
+	{
+		{ "parse-privmsg", parsePrivmsg, 2000000, 0 },
+		{ "parse-tagged", parseTagged, 2000000, 0 },
+		{ "parse-mode", parseMode, 2000000, 0 },
+		{ "frame-pipelined", framePipelined, 4000000, 0 },
+		{ "split-targets", splitTargets, 4000000, 0 },
+		{ "dispatch-privmsg-channel", dispatchPrivmsgChannel, 500000, 2 },
+		{ "dispatch-privmsg-nick", dispatchPrivmsgNick, 500000, 2 },
+		{ "dispatch-mode", dispatchMode, 500000, 2 },
+		{ "dispatch-unknown", dispatchUnknown, 500000, 2 },
+		{ "metrics-observe", metricsObserve, 4000000, 0 },
+		{ "metrics-clock", metricsClock, 4000000, 0 }
+	};
+	cases.assign(fixed, fixed + sizeof(fixed) / sizeof(fixed[0]));
+	static std::string fanoutNames[sizeof(FANOUT_SIZES) / sizeof(FANOUT_SIZES[0])];
+	for (size_t i = 0; i < sizeof(FANOUT_SIZES) / sizeof(FANOUT_SIZES[0]); i++)
+	{
+		fanoutNames[i] = "fanout-" + ft_itoa(FANOUT_SIZES[i]);
+		benchCase c = { fanoutNames[i].c_str(), fanout, 2000000 / FANOUT_SIZES[i], static_cast<size_t>(FANOUT_SIZES[i]) + 1 };
+		cases.push_back(c);
+	}
+
+	std::map<std::string, benchResult> baseline = loadBaseline(path);
+	std::ostringstream saved;
+	saved << "# name ns/op allocs/op\n";
+	bool failed = false;
+
+	try
+	{
+		Server instance(config);
+		server = &instance;
+		server->lockState(&server->getShard(0));
+
+		for (size_t i = 0; i < cases.size(); i++)
+		{
+			addMembers(cases[i].members);
+			benchResult result = measure(cases[i].fn, cases[i].iterations);
+			saved << cases[i].name << " " << result.ns << " " << result.allocs << "\n";
+
+			std::cout << "micro: " << cases[i].name << ": " << result.ns << " ns/op, " << result.allocs << " allocs/op";
+			std::map<std::string, benchResult>::const_iterator base = baseline.find(cases[i].name);
+			if (!save && base != baseline.end())
+			{
+				std::cout << " (baseline " << base->second.ns << " ns, " << base->second.allocs << " allocs)";
+				if (result.allocs > base->second.allocs + 0.01)
+				{
+					std::cout << " MORE ALLOCATIONS";
+					failed = true;
+				}
+				for (int retry = 0; retry < RETRIES && result.ns > base->second.ns * SLOWER_BY; retry++)
+					result.ns = std::min(result.ns, measure(cases[i].fn, cases[i].iterations).ns);
+				if (result.ns > base->second.ns * SLOWER_BY)
+				{
+					std::cout << " SLOWER (" << result.ns << " ns after " << RETRIES << " retries)";
+					failed = true;
+				}
+			}
+			std::cout << std::endl;
+		}
+		server->unlockState();
+		server = NULL;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return (1);
+	}
+
+	if (save)
+	{
+		std::ofstream out(path.c_str());
+		out << saved.str();
+		if (!out)
+		{
+			std::cerr << "Could not write " << path << std::endl;
+			return (1);
+		}
+		std::cout << "micro: baseline written to " << path << std::endl;
+	}
+	return (failed ? 1 : 0);
+}
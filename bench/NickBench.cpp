@@ -0,0 +1,86 @@
+#include "Server.hpp"
+#include <sys/time.h>
+#include <deque>
+
+// PRIVMSG-to-nick latency as the number of connected clients grows. Clients
+// are registered under descriptor numbers that are never opened, far above
+// anything the process uses, so nothing is ever written to them.
+
+static const int FAKE_FD_BASE = 1 << 20;
+static const long ITERATIONS = 20000;
+static const int SIZES[] = { 100, 1000, 10000, 100000 };
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static std::string nickFor(int i)
+{
+	return "n" + ft_itoa(i);
+}
+
+int main(int ac, char **av)
+{
+	serverConfig config;
+	config.port = (ac > 1) ? av[1] : "16668";
+	config.pwd = "pw";
+	config.backend = "poll";
+	config.serverName = "server";
+	config.services = true;
+	config.logLevel = Logger::WARN;
+	config.traceEvents = 0;
+	config.sendqLimit = 1 << 30;
+	config.threads = 1;
+	config.backlog = 16;
+	config.acceptBudget = 16;
+
+	try
+	{
+		Server server(config);
+		std::vector<Client *> registered;
+		std::deque<MessageBuffer> sink;
+
+		server.lockState(&server.getShard(0));
+		for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++)
+		{
+			while (static_cast<int>(registered.size()) < SIZES[s])
+			{
+				int i = registered.size();
+				Client *client = server.registerClient(FAKE_FD_BASE + i, 0);
+				server.handleClientMessage(*client, "PASS pw");
+				server.handleClientMessage(*client, "NICK " + nickFor(i));
+				server.handleClientMessage(*client, "USER u 0 * :Bench");
+				client->takeSendQueue(sink);
+				sink.clear();
+				registered.push_back(client);
+			}
+
+			std::vector<std::string> lines;
+			for (int i = 0; i < 1024; i++)
+				lines.push_back("PRIVMSG " + nickFor((i * 7919) % SIZES[s]) + " :hello");
+
+			double start = now();
+			for (long i = 0; i < ITERATIONS; i++)
+				server.handleClientMessage(*registered[i % SIZES[s]], lines[i & 1023]);
+			double elapsed = now() - start;
+
+			for (size_t i = 0; i < registered.size(); i++)
+			{
+				registered[i]->takeSendQueue(sink);
+				sink.clear();
+			}
+			std::cout << "privmsg-nick: " << SIZES[s] << " clients, "
+				<< elapsed * 1e9 / ITERATIONS << " ns/line" << std::endl;
+		}
+		server.unlockState();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return (1);
+	}
+	return (0);
+}
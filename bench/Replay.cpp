@@ -0,0 +1,508 @@
+#include "Reactor.hpp"
+#include "LineBuffer.hpp"
+#include "Capture.hpp"
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Plays a capture taken with "ircserv --capture=path" back against a running
+// ircserv, every captured connection multiplexed from this one process. By
+// default each line goes out at its captured time, and a connection is
+// half-closed when the capture says it closed. With --pace=max everything is
+// sent as fast as the server takes it and connections stay open, since the
+// server drops the replies still queued for a client that hangs up. The run
+// ends once the server has been quiet for QUIET_MS, and the time reported
+// runs up to the last reply.
+//
+// Each connection's replies are checksummed so runs against two builds can
+// be compared. The checksum ignores reply order within a connection and
+// masks what changes between runs (timestamps, STATS numbers). Connections
+// that talk to each other can still see different replies at max pace,
+// since their lines race; the original pace keeps the captured order.
+//
+//   ./bench/Replay <port> <capture> [--host=127.0.0.1] [--pace=original|max]
+//       [--backend=epoll|poll] [--verbose]
+
+#define RED "\033[1;31m"
+#define RESET "\033[0m"
+
+static const int QUIET_MS = 500;
+static const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+static const unsigned long long FNV_PRIME = 1099511628211ULL;
+
+struct replayConfig
+{
+	std::string	host;
+	int			port;
+	std::string	path;
+	std::string	backend;
+	bool		paced;
+	bool		verbose;
+};
+
+enum connState
+{
+	PENDING,
+	CONNECTING,
+	OPEN,
+	HALF_CLOSED,
+	DONE
+};
+
+struct replayConn
+{
+	unsigned long		id;
+	int					fd;
+	connState			state;
+	bool				closing; // half-close once output is out; original pace only
+	bool				wantsWrite;
+	LineBuffer			input;
+	std::string			output;
+	unsigned long		sent;
+	unsigned long		replies;
+	unsigned long long	checksum;
+};
+
+static long long monotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static long parseNumber(const std::string& value, const std::string& opt)
+{
+	char *end = NULL;
+	long num = std::strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0' || num <= 0)
+		throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+	return num;
+}
+
+static replayConfig parseArgs(int ac, char **av)
+{
+	if (ac < 3)
+		throw std::invalid_argument(RED"Usage: " + std::string(av[0]) + " port capture [--host=addr] [--pace=original|max]"
+			" [--backend=epoll|poll] [--verbose]" RESET);
+
+	replayConfig config;
+	config.port = static_cast<int>(parseNumber(av[1], "port"));
+	config.path = av[2];
+	config.host = "127.0.0.1";
+#ifdef __linux__
+	config.backend = "epoll";
+#else
+	config.backend = "poll";
+#endif
+	config.paced = true;
+	config.verbose = false;
+
+	for (int i = 3; i < ac; i++)
+	{
+		std::string opt = av[i];
+		std::string::size_type eq = opt.find('=');
+		std::string key = opt.substr(0, eq);
+		std::string value = (eq == std::string::npos) ? "" : opt.substr(eq + 1);
+
+		if (key == "--host" && !value.empty())
+			config.host = value;
+		else if (key == "--backend" && !value.empty())
+			config.backend = value;
+		else if (key == "--pace" && (value == "original" || value == "max"))
+			config.paced = value == "original";
+		else if (opt == "--verbose")
+			config.verbose = true;
+		else
+			throw std::invalid_argument(RED"Unknown option: " + opt + RESET);
+	}
+	return config;
+}
+
+static void raiseFdLimit()
+{
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == limit.rlim_max)
+		return;
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+static bool isNumeric(const char *cmd, const char *end, const char *code)
+{
+	return end - cmd >= 4 && std::memcmp(cmd, code, 3) == 0 && cmd[3] == ' ';
+}
+
+// FNV-1a over the line with every run of nine or more digits (a Unix time)
+// collapsed, or 0 for replies whose content is expected to differ: the
+// STATS numbers.
+static unsigned long long replyHash(const lineView& line)
+{
+	const char *data = line.data;
+	const char *end = data + line.size;
+	const char *cmd = data;
+	if (cmd < end && *cmd == ':')
+	{
+		cmd = static_cast<const char *>(std::memchr(cmd, ' ', end - cmd));
+		cmd = cmd == NULL ? end : cmd + 1;
+	}
+	if (isNumeric(cmd, end, "212") || isNumeric(cmd, end, "242") || isNumeric(cmd, end, "249"))
+		return 0;
+
+	unsigned long long hash = FNV_OFFSET;
+	const char *p = data;
+	while (p < end)
+	{
+		const char *run = p;
+		while (run < end && *run >= '0' && *run <= '9')
+			run++;
+		if (run - p >= 9)
+		{
+			hash = (hash ^ '#') * FNV_PRIME;
+			p = run;
+			continue;
+		}
+		if (run == p)
+			run++;
+		for (; p < run; p++)
+			hash = (hash ^ static_cast<unsigned char>(*p)) * FNV_PRIME;
+	}
+	return hash;
+}
+
+class Replay
+{
+	private:
+			replayConfig				config;
+			Reactor						*reactor;
+			std::vector<captureRecord>	records;
+			std::vector<replayConn>		conns;
+			std::vector<size_t>			owner; // record -> connection
+			struct sockaddr_in			addr;
+			size_t						done;
+			unsigned long				errors;
+			unsigned long long			bytesIn;
+			long long					lastInput;
+
+			void updateInterest(replayConn& conn)
+			{
+				bool wantsWrite = conn.state == CONNECTING || !conn.output.empty();
+				if (wantsWrite == conn.wantsWrite)
+					return;
+				reactor->modify(conn.fd, Reactor::READ | (wantsWrite ? Reactor::WRITE : 0), &conn);
+				conn.wantsWrite = wantsWrite;
+			}
+
+			void flush(replayConn& conn)
+			{
+				while (!conn.output.empty())
+				{
+					ssize_t n = ::send(conn.fd, conn.output.data(), conn.output.size(), MSG_NOSIGNAL);
+					if (n > 0)
+					{
+						conn.output.erase(0, n);
+						continue;
+					}
+					if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+						break;
+					finish(conn, true);
+					return;
+				}
+				// The server keeps a client after QUIT; it closes its end
+				// once it reads our end of file.
+				if (conn.output.empty() && conn.closing && conn.state == OPEN)
+				{
+					shutdown(conn.fd, SHUT_WR);
+					conn.state = HALF_CLOSED;
+				}
+				updateInterest(conn);
+			}
+
+			void connect(replayConn& conn)
+			{
+				conn.fd = socket(AF_INET, SOCK_STREAM, 0);
+				if (conn.fd == -1)
+					throw std::runtime_error(RED"socket: " + std::string(strerror(errno)) + RESET);
+				fcntl(conn.fd, F_SETFL, O_NONBLOCK);
+				int one = 1;
+				setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				if (::connect(conn.fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1 && errno != EINPROGRESS)
+					throw std::runtime_error(RED"connect: " + std::string(strerror(errno)) + RESET);
+				conn.state = CONNECTING;
+				conn.wantsWrite = true;
+				reactor->add(conn.fd, Reactor::READ | Reactor::WRITE, &conn);
+			}
+
+			void finish(replayConn& conn, bool error)
+			{
+				if (conn.state == DONE)
+					return;
+				if (error)
+					errors++;
+				if (conn.state != PENDING)
+				{
+					reactor->remove(conn.fd);
+					close(conn.fd);
+				}
+				conn.fd = -1;
+				conn.state = DONE;
+				done++;
+			}
+
+			// A connection the capture never opened (or that is replayed
+			// without its OPEN) is opened by its first line.
+			void apply(const captureRecord& record, replayConn& conn)
+			{
+				if (conn.state == DONE)
+					return;
+				if (conn.state == PENDING)
+				{
+					if (record.type == captureRecord::CLOSE)
+					{
+						finish(conn, false);
+						return;
+					}
+					connect(conn);
+				}
+				if (record.type == captureRecord::LINE)
+				{
+					conn.output += record.line;
+					conn.output += "\r\n";
+					conn.sent++;
+				}
+				else if (record.type == captureRecord::CLOSE)
+					conn.closing = config.paced;
+				if (conn.state == OPEN)
+					flush(conn);
+			}
+
+			void handleRead(replayConn& conn)
+			{
+				for (;;)
+				{
+					size_t room = conn.input.reserve();
+					ssize_t n = recv(conn.fd, conn.input.writePtr(), room, 0);
+					if (n == 0)
+					{
+						finish(conn, false);
+						return;
+					}
+					if (n == -1)
+					{
+						if (errno != EAGAIN && errno != EWOULDBLOCK)
+							finish(conn, true);
+						return;
+					}
+					conn.input.commit(n);
+					bytesIn += n;
+					lastInput = monotonicNs();
+
+					lineView line;
+					while (conn.input.nextLine(line))
+					{
+						conn.replies++;
+						conn.checksum += replyHash(line);
+					}
+					if (static_cast<size_t>(n) < room)
+						return;
+				}
+			}
+
+			void handleEvent(const reactorEvent& event)
+			{
+				replayConn& conn = *static_cast<replayConn *>(event.data);
+				if (conn.state == DONE)
+					return;
+				if (conn.state == CONNECTING && (event.writable || event.hangup))
+				{
+					int err = 0;
+					socklen_t errLen = sizeof(err);
+					getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+					if (err != 0)
+					{
+						finish(conn, true);
+						return;
+					}
+					conn.state = OPEN;
+					flush(conn);
+				}
+				else if (event.writable)
+					flush(conn);
+				if (conn.state != DONE && (event.readable || event.hangup))
+					handleRead(conn);
+			}
+
+			bool pendingOutput() const
+			{
+				for (size_t i = 0; i < conns.size(); ++i)
+					if (conns[i].state != DONE && !conns[i].output.empty())
+						return true;
+				return false;
+			}
+
+			void poll(int timeout)
+			{
+				std::vector<reactorEvent> events;
+				reactor->wait(events, timeout);
+				for (size_t i = 0; i < events.size(); ++i)
+					handleEvent(events[i]);
+			}
+
+			// Order-sensitive across connections, which are numbered in
+			// the order the capture opened them.
+			unsigned long long checksum() const
+			{
+				unsigned long long total = FNV_OFFSET;
+				for (size_t i = 0; i < conns.size(); ++i)
+					total = (total ^ conns[i].checksum) * FNV_PRIME;
+				return total;
+			}
+
+	public:
+			Replay(const replayConfig& config) : config(config), reactor(Reactor::create(config.backend)), done(0), errors(0), bytesIn(0), lastInput(0)
+			{
+				std::memset(&addr, 0, sizeof(addr));
+				addr.sin_family = AF_INET;
+				addr.sin_port = htons(config.port);
+				if (inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr) != 1)
+				{
+					delete reactor;
+					throw std::invalid_argument(RED"Invalid host: " + config.host + RESET);
+				}
+
+				CaptureReader reader(config.path);
+				std::map<unsigned long, size_t> index;
+				captureRecord record;
+				while (reader.next(record))
+				{
+					std::map<unsigned long, size_t>::iterator it = index.find(record.connection);
+					if (it == index.end())
+						it = index.insert(std::make_pair(record.connection, index.size())).first;
+					records.push_back(record);
+					owner.push_back(it->second);
+				}
+
+				conns.resize(index.size());
+				for (std::map<unsigned long, size_t>::iterator it = index.begin(); it != index.end(); ++it)
+				{
+					replayConn& conn = conns[it->second];
+					conn.id = it->first;
+					conn.fd = -1;
+					conn.state = PENDING;
+					conn.closing = false;
+					conn.wantsWrite = false;
+					conn.sent = 0;
+					conn.replies = 0;
+					conn.checksum = 0;
+				}
+			}
+
+			~Replay()
+			{
+				for (size_t i = 0; i < conns.size(); ++i)
+					if (conns[i].fd != -1)
+						close(conns[i].fd);
+				delete reactor;
+			}
+
+			void run()
+			{
+				unsigned long lines = 0;
+				for (size_t i = 0; i < records.size(); ++i)
+					lines += records[i].type == captureRecord::LINE;
+				double span = records.empty() ? 0 : (records.back().time - records.front().time) / 1e6;
+				std::cout << "replay: " << config.path << ": " << conns.size() << " connections, " << lines << " lines over "
+					<< span << " s, at " << (config.paced ? "the original pace" : "max pace") << std::endl;
+
+				long long start = monotonicNs();
+				size_t next = 0;
+				while (next < records.size())
+				{
+					long long now = monotonicNs();
+					while (next < records.size())
+					{
+						long long due = start + static_cast<long long>(records[next].time - records[0].time) * 1000;
+						if (config.paced && due > now)
+							break;
+						apply(records[next], conns[owner[next]]);
+						next++;
+					}
+					if (next < records.size())
+					{
+						long long wait = start + static_cast<long long>(records[next].time - records[0].time) * 1000 - monotonicNs();
+						poll(config.paced && wait > 0 ? static_cast<int>(std::min(wait / 1000000 + 1, 10LL)) : 0);
+					}
+				}
+
+				// Replies are complete once nothing is left to send and the
+				// server has been quiet for a while.
+				long long last = monotonicNs();
+				for (;;)
+				{
+					poll(10);
+					long long now = monotonicNs();
+					if (pendingOutput())
+						last = now;
+					else if (now - std::max(last, lastInput) >= QUIET_MS * 1000000LL)
+						break;
+				}
+				report((std::max(last, lastInput) - start) / 1e9, lines);
+			}
+
+			void report(double elapsed, unsigned long lines) const
+			{
+				unsigned long replies = 0;
+				for (size_t i = 0; i < conns.size(); ++i)
+				{
+					const replayConn& conn = conns[i];
+					replies += conn.replies;
+					if (config.verbose)
+					{
+						char sum[17];
+						std::snprintf(sum, sizeof(sum), "%016llx", conn.checksum);
+						std::cout << "connection " << conn.id << ": sent " << conn.sent << ", replies " << conn.replies
+							<< ", checksum " << sum << std::endl;
+					}
+				}
+				std::cout << "elapsed: " << elapsed << " s, " << lines / elapsed << " lines/s sent" << std::endl;
+				std::cout << "replies: " << replies << " lines, " << bytesIn << " bytes" << std::endl;
+				std::cout << "closed by the server: " << done << "/" << conns.size() << " connections, errors: " << errors << std::endl;
+				char sum[17];
+				std::snprintf(sum, sizeof(sum), "%016llx", checksum());
+				std::cout << "checksum: " << sum << std::endl;
+			}
+};
+
+int main(int ac, char **av)
+{
+	try
+	{
+		replayConfig config = parseArgs(ac, av);
+		signal(SIGPIPE, SIG_IGN);
+		raiseFdLimit();
+		Replay replay(config);
+		replay.run();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return (1);
+	}
+	return (0);
+}
@@ -0,0 +1,76 @@
+#include "Reply.hpp"
+#include <sys/time.h>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Cost of formatting the replies the command layer sends most, and the
+// number of heap allocations it takes. Every allocation in the process goes
+// through the counting operator new below.
+
+static const long ITERATIONS = 1000000;
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) throw(std::bad_alloc)
+{
+	allocations++;
+	void *p = std::malloc(size == 0 ? 1 : size);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) throw()
+{
+	std::free(p);
+}
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main()
+{
+	std::string line;
+	line.reserve(Reply::LINE_LIMIT);
+	Reply reply(line, "irc.example.net");
+
+	const std::string nick = "benchmarker";
+	const std::string prefix = "benchmarker!bench@host.example.net";
+	const std::string channel = "#benchmark";
+	const std::string text = "the quick brown fox jumps over the lazy dog";
+	size_t bytes = 0;
+
+	unsigned long before = allocations;
+	double start = now();
+	for (long i = 0; i < ITERATIONS; i++)
+	{
+		switch (i & 3)
+		{
+			case 0:
+				bytes += reply.numeric(Reply::ERR_NOSUCHCHANNEL, nick).param(channel).end().size();
+				break;
+			case 1:
+				bytes += reply.numeric(Reply::RPL_TOPICWHOTIME, nick).param(channel).param(nick).param(1700000000L + i).end().size();
+				break;
+			case 2:
+				bytes += reply.command(prefix, "PRIVMSG").param(channel).trailing(text).end().size();
+				break;
+			case 3:
+				bytes += reply.numeric(Reply::ERR_NEEDMOREPARAMS, nick).param("MODE").end().size();
+				break;
+		}
+	}
+	double elapsed = now() - start;
+	unsigned long used = allocations - before;
+
+	std::cout << "reply: " << ITERATIONS << " replies, "
+		<< elapsed * 1e9 / ITERATIONS << " ns/reply, "
+		<< static_cast<double>(used) / ITERATIONS << " allocs/reply"
+		<< " (" << bytes / ITERATIONS << " bytes avg)" << std::endl;
+	return (used == 0 ? 0 : 1);
+}
@@ -0,0 +1,99 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "LineBuffer.hpp"
+#include "Logger.hpp"
+
+// Client traffic recorded at the framing layer, for bench/Replay. The file
+// is the magic "IRCCAP1\n" followed by records:
+//
+//   kind (1 byte: OPEN, LINE or CLOSE)
+//   connection id (varint, the server's client id)
+//   microseconds since the previous record (varint)
+//   LINE only: length (varint) and the line, without its CRLF
+//
+// Varints are little-endian base 128. Records are written in the order the
+// server handled them, so each connection's lines stay in order.
+struct captureRecord
+{
+	enum kind
+	{
+		OPEN = 1,
+		LINE = 2,
+		CLOSE = 3
+	};
+
+	kind				type;
+	unsigned long		connection;
+	unsigned long long	time; // microseconds since the capture started
+	std::string			line;
+};
+
+// Every call is made under the server's state lock, so records from all
+// shards land in one buffer without locking of their own. Once the buffer
+// holds FLUSH_SIZE bytes it is swapped onto a short queue, and a thread of
+// the capture's own writes it out, so the lock is never held across a
+// write. If a write fails, or the disk falls QUEUE_LIMIT buffers behind, the
+// capture stops with a warning and the server goes on.
+class Capture
+{
+	private:
+			static const size_t	FLUSH_SIZE = 64 * 1024;
+			static const size_t	QUEUE_LIMIT = 64;
+
+			Logger					&logger;
+			int						fd;
+			std::string				path;
+			std::string				buffer;
+			unsigned long long		last;
+			bool					failed;
+			std::deque<std::string>	queue; // guarded by queueLock
+			pthread_mutex_t			queueLock;
+			pthread_cond_t			queueReady;
+			bool					stopping; // guarded by queueLock
+			int						writeFailed;
+			pthread_t				writer;
+
+			Capture(const Capture&);
+			Capture& operator=(const Capture&);
+
+			void	begin(captureRecord::kind type, unsigned long connection);
+			void	putVarint(unsigned long long value);
+			void	flush();
+			bool	write(const std::string& data);
+			void	run();
+
+			static void	*writerMain(void *arg);
+
+	public:
+			static const char	MAGIC[9];
+
+			Capture(Logger& logger, const std::string& path);
+			~Capture();
+
+			void	connected(unsigned long connection);
+			void	received(unsigned long connection, const lineView& line);
+			void	disconnected(unsigned long connection);
+};
+
+// Reads a whole capture file into memory.
+class CaptureReader
+{
+	private:
+			std::vector<char>	data;
+			size_t				pos;
+			unsigned long long	time;
+
+			bool	getVarint(unsigned long long& value);
+
+	public:
+			CaptureReader(const std::string& path);
+
+			bool	next(captureRecord& out);
+};
+
+#endif
@@ -5,50 +5,94 @@
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <ctime>
+#include <tr1/unordered_map>
+#include "NameTable.hpp"
 
-class Client;
+// A channel member is the fd its client is stored under plus per-member
+// status, so nothing about the client is copied into the channel.
+struct channelMember
+{
+	static const unsigned	OP = 1;
+	static const unsigned	VOICE = 2;
+	static const unsigned	SERVICE = 4;
+
+	int			fd;
+	unsigned	flags;
+	size_t		chunk; // the NAMES chunk holding this member while the list is valid
+};
 
 class Channel
 {
 	private:
 		std::string					name;
+		nameId						id;
 		std::string					pwd;
 		std::string					topic;
-		std::vector<Client>			users;
-		std::vector<std::string>	ops;
-		std::vector<std::string>	invitedUsers;
-		bool						invOnly;
-		bool						topicSet;
-		int							maxUsers;
+		std::vector<channelMember>	members;
+		std::tr1::unordered_map<int, size_t>	memberIndex;
+		std::tr1::unordered_map<unsigned long, std::time_t>	invites;
+		unsigned					modes;
+		std::string					key;
+		size_t						limit;
+		std::vector<std::string>	names;
+		size_t						namesBudget;
+		bool						namesValid;
+		size_t						serviceCount;
+
+		static std::string nameEntry(const std::string& nickname, unsigned flags);
+		void appendName(size_t pos, const std::string& entry);
+		bool eraseName(size_t pos, const std::string& entry);
+		void replaceName(size_t pos, const std::string& oldEntry, const std::string& entry);
+		void invalidateNames();
 
 	public:
+			// Channel mode bits. +k and +l keep their parameter in key and
+			// limit, which only mean something while the bit is set.
+			static const unsigned	MODE_INVITE = 1;
+			static const unsigned	MODE_KEY = 2;
+			static const unsigned	MODE_LIMIT = 4;
+			static const unsigned	MODE_TOPIC = 8;
+
 			Channel();
-			Channel(const std::string& name);
+			Channel(const std::string& name, nameId id, size_t namesBudget);
 			~Channel();
 			void setName(const std::string& name);
-			void setPwd(const std::string& pwd);
-			void setInvOnly(const bool& invOnly);
-			void setMaxUsers(const int& maxUsers);
 			void setTopic(const std::string& topic);
-			
-			std::string	getName() const;
-			std::string	getPwd() const;
-			bool		getInvOnly() const;
-			bool		isOp(const std::string& nickName) const;
-			bool		isUserInChannel(const std::string &check) const;
-			bool		getTopicSet() const;
-			void		setTopicSet(const bool& topicSet);
-			int			getMaxUsers() const;
-			std::vector<std::string> &getOps();
-			std::string getTopic() const;
-			std::vector<std::string>& getInvitedUsers();
-			std::vector<Client>& getUsers();
-			
-			void addinvitedUser(const std::string& user);
-			void addUser(const Client& user);
-			void addOp(const std::string& op);
-			void removeUser(const Client& user);
-			void removeOp(const std::string& op);
+			void setMode(unsigned mode, bool on);
+			void setKey(const std::string& key);
+			void setLimit(size_t limit);
+
+			const std::string& getName() const;
+			nameId		getId() const;
+			bool		hasMode(unsigned mode) const;
+			const std::string& getKey() const;
+			size_t		getLimit() const;
+			std::string	getModeString() const;
+			bool		isFull() const;
+			bool		isOp(int fd) const;
+			bool		isService(int fd) const;
+			bool		hasMember(int fd) const;
+			const std::string& getTopic() const;
+			const std::vector<channelMember>& getMembers() const;
+			size_t		getMemberCount() const;
+			bool		hasUsers() const;
+
+			void addInvite(unsigned long clientId, std::time_t now);
+			bool isInvited(unsigned long clientId, std::time_t now);
+			void removeInvite(unsigned long clientId);
+			bool addMember(int fd, unsigned flags, const std::string& nickname);
+			unsigned removeMember(int fd, const std::string& nickname);
+			void setOp(int fd, bool op, const std::string& nickname);
+			void renameMember(int fd, const std::string& oldNickname, const std::string& nickname);
+			bool pickOp(int excludeFd, int& chosen) const;
+
+			bool hasNames() const;
+			const std::vector<std::string>& getNames() const;
+			void resetNames();
+			void addName(int fd, const std::string& nickname);
 };
 
+typedef std::tr1::unordered_map<nameId, Channel> channelMap;
+
 #endif
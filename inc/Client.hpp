@@ -5,50 +5,93 @@
 #include <algorithm>
 #include <string>
 #include <vector>
+#include <deque>
+#include <sys/uio.h>
+#include "MessageBuffer.hpp"
+#include "LineBuffer.hpp"
+#include "NameTable.hpp"
 
 class Client
 {
 	private:
 			int			fd;
+			unsigned long	id;
+			int			shard;
 			std::string	nickname;
+			nameId		nickId;
 			std::string	username;
 			std::string	hostname;
 			std::string	realname;
 			std::string	servername;
-			std::string	buffer;
+			std::string	prefix;
+			LineBuffer	input;
+			std::deque<MessageBuffer>	sendQueue;
+			size_t		sendOffset;
+			size_t		sendQueueBytes;
 			std::string pwd;
 			bool		isAuth;
+			bool		isOper;
+			bool		flushPending;
+			bool		wantsWrite;
+			bool		closing;
+			std::string	closeReason;
 
-			std::vector<std::string> joined_channels;
+			std::vector<nameId> joined_channels;
+
+			void		updatePrefix();
 	public:
 			Client(const int& fd);
 			~Client();
+			void		reset(const int& fd);
 			int			getFd() const;
-			std::string	getNickname() const;
-			std::string	getUsername() const;
-			std::string	getHostname() const;
-			std::string	getRealname() const;
-			std::string	getServername() const;
-			std::string	getPwd() const;
+			unsigned long	getId() const;
+			int			getShard() const;
+			void		setId(const unsigned long& id);
+			void		setShard(const int& shard);
+			const std::string&	getNickname() const;
+			nameId		getNickId() const;
+			const std::string&	getPrefix() const;
+			const std::string&	getUsername() const;
+			const std::string&	getHostname() const;
+			const std::string&	getRealname() const;
+			const std::string&	getServername() const;
+			const std::string&	getPwd() const;
 			bool		getIsAuth() const;
+			bool		getIsOper() const;
 			bool		isProvided() const;
 
-			bool		hasFullMessage(std::string& out);
-			std::string	&getBuffer();
-			void 		appendToBuffer(const std::string& buffer);
+			LineBuffer	&getInput();
 			void 		clearBuffer();
 
+			void		queueMessage(const MessageBuffer& msg);
+			bool		flushSendQueue();
+			int			peekSendQueue(struct iovec *iov, int max) const;
+			void		consumeSendQueue(size_t n);
+			size_t		takeSendQueue(std::deque<MessageBuffer>& out);
+			size_t		getSendQueueSize() const;
+			bool		hasPendingOutput() const;
+			bool		getFlushPending() const;
+			void		setFlushPending(const bool& flushPending);
+			bool		getWantsWrite() const;
+			void		setWantsWrite(const bool& wantsWrite);
+
+			void		markForClose(const std::string& reason);
+			bool		isClosing() const;
+			const std::string&	getCloseReason() const;
+
 			void		setIsAuth(const bool& isAuth);
+			void		setIsOper(const bool& isOper);
 			void		setNickname(const std::string& nickname);
+			void		setNickId(nameId nickId);
 			void		setUsername(const std::string& username);
 			void		setHostname(const std::string& hostname);
 			void		setRealname(const std::string& realname);
 			void		setServername(const std::string& servername);
 			void		setPwd(const std::string& pwd);
 
-			void		joinChannel(const std::string& channel);
-			void		partChannel(const std::string& channel);
-			const std::vector<std::string>& getJoinedChannels() const;
+			void		joinChannel(nameId channel);
+			void		partChannel(nameId channel);
+			const std::vector<nameId>& getJoinedChannels() const;
 };
 
 #endif
@@ -0,0 +1,41 @@
+#ifndef CLIENTTABLE_HPP
+#define CLIENTTABLE_HPP
+
+#include <vector>
+#include "Client.hpp"
+
+// Registered clients, indexed by fd. Client objects are carved out of
+// fixed-size blocks and recycled through a free list rather than destroyed,
+// so connecting and disconnecting reuse storage (strings and buffers
+// included) instead of going to the heap. A Client* stays valid until its
+// slot is erased; holders that may outlive that compare the client id, which
+// is never reused.
+class ClientTable
+{
+	private:
+			static const size_t	CLIENTS_PER_BLOCK = 64;
+
+			std::vector<Client *>	slots;
+			std::vector<Client *>	blocks;
+			std::vector<Client *>	freeList;
+			size_t					constructed;
+			size_t					count;
+
+			ClientTable(const ClientTable&);
+			ClientTable& operator=(const ClientTable&);
+
+			Client	*allocate();
+
+	public:
+			ClientTable();
+			~ClientTable();
+
+			Client	*insert(int fd);
+			void	erase(int fd);
+			Client	*find(int fd) const;
+			Client	*find(int fd, unsigned long id) const;
+			size_t	size() const;
+			int		limit() const;
+};
+
+#endif
@@ -2,8 +2,15 @@
 #define COMMANDS_HPP
 
 #include "Client.hpp"
+#include "ClientTable.hpp"
 #include "Channel.hpp"
 #include "Server.hpp"
+#include "Parser.hpp"
+#include "Reply.hpp"
+#include "ServiceBus.hpp"
+#include "Config.hpp"
+#include "Metrics.hpp"
+#include "Tracer.hpp"
 #include <map>
 #include <string>
 
@@ -11,42 +18,84 @@ class Client;
 class Channel;
 class Server;
 
-class Commands
+// Also the host services act through; that side is private, so only the
+// service bus sees it.
+class Commands : private ServiceHost
 {
 	private:
-		std::map<int, Client>& clients;
-		std::map<std::string, Channel>& channels;
+		ClientTable& clients;
+		channelMap& channels;
+		NameTable& names;
 		static const int BOT_FD; // set -1 to indicate bot because it is not a real client
+		static const size_t NICKLEN = 30;
+		static const size_t CHANNELLEN = 50;
 		Server& server;
-		bool botExists;
-
-		typedef void (Commands::*CommandHandler)(const std::string&, Client&);
-
-		std::map<std::string, CommandHandler> commandHandlers;
-		void initializeCommandHandlers();
-
-		void handlePass(const std::string& message, Client& client);
-		void handleJoin(const std::string& channelName, Client& client);
-		void handlePrivmsg(const std::string& message, Client& sender);
-		void handleUserCommand(const std::string& msg, Client& client);
-		void handleNickCommand(const std::string& nick, Client& client);
-		void handleModeCommand(const std::string& msg, Client& client);
-		void handlePartCommand(const std::string& msg, Client& client);
-		void handleQuitCommand(const std::string& msg, Client& client);
-		void handleTopicCommand(const std::string& msg, Client& client);
-		void handleKickCommand(const std::string& msg, Client& client);
-		void handleInviteCommand(const std::string& msg, Client& client);
-		bool isOP(const std::string& channelName, const Client& client);
-
-		void createBot();
-		void botJoinChannel(const std::string& channelName);
-		void botGreetUser(const std::string& channelName, const std::string& nickname);
-		void botGiveOpToUser(const std::string& channelName, const std::string& nickname);
-		bool isBotCreated() const;
+		Metrics& metrics;
+		Tracer& tracer;
+		std::string operName; // the --oper credential; empty when OPER is off
+		std::string operPassword;
+		ServiceBus services; // owns the bots; they live outside the client table since they have no socket
+		std::string line; // scratch for building outgoing lines; reused across commands
+		Reply reply; // writes into line
+		std::vector<unsigned> delivered; // per fd, the last delivery round that reached it
+		unsigned deliveryRound;
+		std::string tracedChannel; // what the current command reached, kept only while tracing
+		size_t tracedFanout;
+
+		typedef void (Commands::*CommandHandler)(const ircMessage&, Client&);
+
+		static const CommandHandler handlers[Metrics::COMMAND_COUNT];
+
+		static Metrics::command findCommand(const lineView& cmd);
+
+		void runCommand(const ircMessage& msg, Metrics::command slot, Client& client);
+		void traceCommand(const ircMessage& msg, Metrics::command slot, const Client& client,
+			unsigned long long start, unsigned long long end);
+		void noteFanout(const Channel& channel, size_t recipients);
+
+		void handlePass(const ircMessage& msg, Client& client);
+		void handleJoin(const ircMessage& msg, Client& client);
+		void handlePrivmsg(const ircMessage& msg, Client& sender);
+		void handleUserCommand(const ircMessage& msg, Client& client);
+		void handleNickCommand(const ircMessage& msg, Client& client);
+		void handleModeCommand(const ircMessage& msg, Client& client);
+		void handlePartCommand(const ircMessage& msg, Client& client);
+		void handleQuitCommand(const ircMessage& msg, Client& client);
+		void handleTopicCommand(const ircMessage& msg, Client& client);
+		void handleKickCommand(const ircMessage& msg, Client& client);
+		void handleInviteCommand(const ircMessage& msg, Client& client);
+		void handleNamesCommand(const ircMessage& msg, Client& client);
+		void handleStatsCommand(const ircMessage& msg, Client& client);
+		void handleOperCommand(const ircMessage& msg, Client& client);
+		void joinChannel(std::string channelName, const lineView& key, Client& client);
+		void partChannel(const std::string& channelName, Client& client);
+		void privmsgTarget(const std::string& target, const lineView& text, Client& sender);
+		void beginDelivery();
+		bool markDelivered(int fd);
+		void sendNames(Channel& channel, const Client& client);
+		bool isOP(const Channel& channel, const Client& client);
+		Channel *findChannel(const std::string& name);
+		Channel& createChannel(const std::string& name);
+		void dropChannel(Channel& channel);
+		void removeOp(Channel& channel, const Client& client);
+		void removeMember(Channel& channel, const Client& client);
+		void promoteOp(Channel& channel, int excludeFd);
+		Client *memberClient(const channelMember& member);
+		void broadcast(Channel& channel, const std::string& msg, int skipFd = BOT_FD);
+		void broadcast(Channel& channel, const MessageBuffer& msg, int skipFd = BOT_FD);
+		void broadcastOnce(Channel& channel, const MessageBuffer& msg);
+
+		Channel *findChannel(nameId id);
+		Client *findClient(int fd, unsigned long id);
+		bool registerService(Client& service, const std::string& nickname);
+		void serviceJoin(Client& service, Channel& channel);
+		void serviceMessage(Client& service, Channel& channel, const std::string& text);
+		void serviceNotice(Client& service, const Client& target, const std::string& text);
+		void serviceOp(Client& service, Channel& channel, const Client& target);
 
 		public:
-			Commands(std::map<int, Client>& c, std::map<std::string, Channel>& ch, Server& server);
-			void executeCommand(const std::string& raw, Client& client);
+			Commands(ClientTable& c, channelMap& ch, NameTable& names, const serverConfig& config, Server& server);
+			void executeCommand(const ircMessage& msg, size_t size, Client& client);
 };
 
 std::string ft_itoa(int num);
@@ -0,0 +1,38 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <cstddef>
+#include <vector>
+
+struct serverConfig
+{
+	std::string	port;
+	std::string	pwd;
+	std::string	backend;
+	std::string	serverName;
+	size_t		sendqLimit;
+	int			threads;
+	int			backlog;
+	int			acceptBudget;
+	bool		services;
+	std::vector<std::string>	botAdmins;
+	std::string	operName; // OPER credential; empty leaves OPER off
+	std::string	operPassword;
+	std::string	metricsSocket; // empty leaves the metrics endpoint off
+	int			logLevel; // a Logger::level
+	std::string	logFile; // empty for stdout
+	std::vector<unsigned>	logSample; // one in n lines per Logger::category, 0 for none; missing entries are 1
+	size_t		traceEvents; // per event loop; 0 leaves tracing off
+	std::string	traceFile;
+	std::string	captureFile; // empty leaves capture off
+};
+
+class Config
+{
+	public:
+		static serverConfig parse(int ac, char **av);
+		static std::string usage(const std::string& program);
+};
+
+#endif
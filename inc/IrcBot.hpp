@@ -0,0 +1,27 @@
+#ifndef IRCBOT_HPP
+#define IRCBOT_HPP
+
+#include <string>
+#include <vector>
+#include "Service.hpp"
+
+// The server's helper bot. It follows users into every channel they join,
+// welcomes them, and makes the configured admins channel operators.
+class IrcBot : public Service
+{
+	private:
+			std::vector<std::string>	admins;
+
+			bool	isAdmin(const std::string& nickname) const;
+
+	public:
+			static const char	*NICKNAME;
+
+			IrcBot(int fd, const std::vector<std::string>& admins);
+
+			int		subscriptions() const;
+			bool	start(ServiceHost& host);
+			void	handle(const serviceEvent& event, ServiceHost& host);
+};
+
+#endif
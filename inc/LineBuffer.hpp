@@ -0,0 +1,41 @@
+#ifndef LINEBUFFER_HPP
+#define LINEBUFFER_HPP
+
+#include <cstddef>
+#include <vector>
+
+struct lineView
+{
+	const char	*data;
+	size_t		size;
+};
+
+// Per-connection input framing. The socket is read straight into the buffer
+// and complete CRLF-terminated lines are handed out as views into it, without
+// copying. Scanning resumes where it stopped, so every byte is looked at once.
+// Lines longer than the RFC 1459 limit are truncated to 510 bytes and the rest
+// of the line is dropped, which also bounds how much a partial line can hold.
+class LineBuffer
+{
+	private:
+			std::vector<char>	storage;
+			size_t				start;
+			size_t				scan;
+			size_t				end;
+			bool				truncating;
+
+	public:
+			static const size_t	CAPACITY = 8192;
+			static const size_t	MAX_LINE = 512;
+
+			LineBuffer();
+
+			size_t	reserve();
+			char	*writePtr();
+			void	commit(size_t n);
+			bool	nextLine(lineView& out);
+			size_t	pending() const;
+			void	clear();
+};
+
+#endif
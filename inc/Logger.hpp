@@ -0,0 +1,99 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <ctime>
+#include "Config.hpp"
+
+// Server log. Callers format a line straight into a slot of a fixed ring
+// (bounded Vyukov queue: one compare-and-swap to claim a slot, no lock, no
+// allocation) and a background thread drains the ring in batches, one write
+// per batch, to stdout or the log file. A full ring drops the line and
+// counts it rather than stalling an event loop. Lines are filtered by level
+// first and then sampled per category, so a category can be cut to one line
+// in n, or off with 0.
+class Logger
+{
+	public:
+			enum level
+			{
+				DEBUG,
+				INFO,
+				WARN,
+				ERROR,
+				LEVEL_COUNT
+			};
+
+			enum category
+			{
+				SERVER,
+				CONN,
+				MESSAGE, // every line a client sends; DEBUG, so off by default
+				IO,
+				CATEGORY_COUNT
+			};
+
+	private:
+			static const size_t		CAPACITY = 2048; // power of two
+			static const size_t		TEXT_SIZE = 600; // room for a full protocol line
+			static const int		FLUSH_MS = 50;
+
+			struct record
+			{
+				unsigned long		sequence;
+				struct timespec		time;
+				unsigned char		level;
+				unsigned char		category;
+				unsigned short		length;
+				char				text[TEXT_SIZE];
+			};
+
+			std::vector<record>	ring;
+			unsigned long		tail; // next slot a producer claims
+			unsigned long		head; // next slot the writer thread reads
+			unsigned long		dropped;
+			unsigned long		seen[CATEGORY_COUNT];
+			unsigned			sample[CATEGORY_COUNT];
+			int					minLevel;
+			int					fd;
+			bool				ownsFd;
+			int					wakeFds[2];
+			int					stopping;
+			pthread_t			thread;
+			bool				threadStarted;
+			std::string			batch;
+			std::time_t			stampSecond;
+			char				stamp[24];
+
+			Logger(const Logger&);
+			Logger& operator=(const Logger&);
+
+			bool	drain();
+			void	append(const record& r);
+			void	flush();
+			void	wake();
+			void	run();
+
+			static void	*threadMain(void *arg);
+
+	public:
+			Logger(const serverConfig& config);
+			~Logger();
+
+			void	start();
+			void	stop();
+
+			bool	enabled(level l, category c) const
+			{
+				return l >= minLevel && sample[c] != 0;
+			}
+
+			void	log(level l, category c, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+			static int	parseLevel(const std::string& name);
+			static int	parseCategory(const std::string& name);
+};
+
+#endif
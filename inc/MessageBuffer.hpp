@@ -0,0 +1,35 @@
+#ifndef MESSAGEBUFFER_HPP
+#define MESSAGEBUFFER_HPP
+
+#include <string>
+
+// Immutable, reference-counted wire message. A broadcast is serialized once
+// and the same payload is queued for every recipient, possibly on several
+// shards at once, so the count is updated atomically.
+class MessageBuffer
+{
+	private:
+			struct Payload
+			{
+				int			refs;
+				std::string	data;
+			};
+
+			Payload	*payload;
+
+			void	release();
+
+	public:
+			MessageBuffer();
+			explicit MessageBuffer(const std::string& data);
+			MessageBuffer(const MessageBuffer& other);
+			MessageBuffer& operator=(const MessageBuffer& other);
+			~MessageBuffer();
+
+			const char	*data() const;
+			size_t		size() const;
+			bool		empty() const;
+			int			useCount() const;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+// Counters and histograms for the server core. Every block of metrics has a
+// single writer at a time: each shard records its I/O into its own block,
+// and everything recorded by the command layer goes into one block that is
+// only written under the state lock. So recording is a relaxed load and
+// store, no locked instruction, and readers (STATS, the scrape endpoint)
+// load the same words without stopping anyone. Reads may be a few updates
+// behind and not mutually consistent, which is fine for monitoring.
+class Metrics
+{
+	public:
+			enum counter
+			{
+				BYTES_READ,
+				BYTES_WRITTEN,
+				LINES_PARSED,
+				FANOUT_MESSAGES,
+				FANOUT_RECIPIENTS,
+				LOOP_ITERATIONS,
+				COUNTER_COUNT
+			};
+
+			enum gauge
+			{
+				CLIENTS,
+				CHANNELS,
+				GAUGE_COUNT
+			};
+
+			// Commands are counted and timed in these slots; anything the
+			// dispatcher does not know lands in UNKNOWN.
+			enum command
+			{
+				CMD_PASS,
+				CMD_NICK,
+				CMD_USER,
+				CMD_JOIN,
+				CMD_PART,
+				CMD_PRIVMSG,
+				CMD_MODE,
+				CMD_TOPIC,
+				CMD_KICK,
+				CMD_INVITE,
+				CMD_NAMES,
+				CMD_QUIT,
+				CMD_STATS,
+				CMD_OPER,
+				CMD_UNKNOWN,
+				COMMAND_COUNT
+			};
+
+			// Power-of-two buckets: bucket i holds values below 2^i, so
+			// every value fits in BUCKETS buckets.
+			static const int	BUCKETS = 40;
+
+			struct histogram
+			{
+				unsigned long long	buckets[BUCKETS];
+				unsigned long long	count;
+				unsigned long long	sum;
+			};
+
+			static const char	*COMMAND_NAMES[COMMAND_COUNT];
+
+	private:
+			// Padded so that two shards never write the same cache line.
+			struct block
+			{
+				unsigned long long	counters[COUNTER_COUNT];
+				histogram			loopTime;
+				char				pad[64];
+			};
+
+			std::vector<block>	shards;
+			block				core;
+			unsigned long long	gauges[GAUGE_COUNT];
+			unsigned long long	commandCounts[COMMAND_COUNT];
+			unsigned long long	commandBytes[COMMAND_COUNT];
+			histogram			commandTime[COMMAND_COUNT];
+			histogram			fanout;
+			std::time_t			started;
+
+			Metrics(const Metrics&);
+			Metrics& operator=(const Metrics&);
+
+			static void	bump(unsigned long long& slot, unsigned long long n)
+			{
+				__atomic_store_n(&slot, __atomic_load_n(&slot, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+			}
+
+			static void	record(histogram& h, unsigned long long value)
+			{
+				int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+				if (bucket >= BUCKETS)
+					bucket = BUCKETS - 1;
+				bump(h.buckets[bucket], 1);
+				bump(h.count, 1);
+				bump(h.sum, value);
+			}
+
+			static unsigned long long	load(const unsigned long long& slot);
+			static void	collect(const histogram& from, histogram& into);
+			static void	renderHistogram(std::string& out, const char *name, const std::string& labels,
+							const histogram& h, int firstBucket, int step, double scale);
+
+	public:
+			Metrics(int shardCount);
+
+			// Shard side; only ever called by the shard's own thread.
+			void	add(int shard, counter c, unsigned long long n)
+			{
+				bump(shards[shard].counters[c], n);
+			}
+
+			void	observeLoop(int shard, unsigned long long ns)
+			{
+				bump(shards[shard].counters[LOOP_ITERATIONS], 1);
+				record(shards[shard].loopTime, ns);
+			}
+
+			// Command side; only called with the state lock held.
+			void	add(counter c, unsigned long long n)
+			{
+				bump(core.counters[c], n);
+			}
+
+			void	setGauge(gauge g, unsigned long long value)
+			{
+				__atomic_store_n(&gauges[g], value, __ATOMIC_RELAXED);
+			}
+
+			void	observeCommand(command cmd, size_t bytes, unsigned long long ns)
+			{
+				bump(commandCounts[cmd], 1);
+				bump(commandBytes[cmd], bytes);
+				record(commandTime[cmd], ns);
+			}
+
+			void	observeFanout(size_t recipients)
+			{
+				bump(core.counters[FANOUT_MESSAGES], 1);
+				bump(core.counters[FANOUT_RECIPIENTS], recipients);
+				record(fanout, recipients);
+			}
+
+			// Readers; safe from any thread.
+			unsigned long long	get(counter c) const;
+			unsigned long long	get(gauge g) const;
+			unsigned long long	getCommandCount(command cmd) const;
+			unsigned long long	getCommandBytes(command cmd) const;
+			void				getCommandTime(command cmd, histogram& out) const;
+			void				getLoopTime(histogram& out) const;
+			void				getFanout(histogram& out) const;
+			std::time_t			getStarted() const;
+			std::string			render() const;
+
+			static unsigned long long	percentile(const histogram& h, double p);
+			static unsigned long long	nowNs();
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef METRICSENDPOINT_HPP
+#define METRICSENDPOINT_HPP
+
+#include <pthread.h>
+#include <string>
+#include "Metrics.hpp"
+#include "Logger.hpp"
+
+// Serves the metrics in Prometheus text format on a local Unix socket, from
+// a thread of its own so a slow scraper never holds up an event loop. Each
+// connection gets one rendering and is closed. A request that starts with
+// "GET " is answered as HTTP, so both a plain reader (nc -U) and an HTTP
+// client speaking over the socket work.
+class MetricsEndpoint
+{
+	private:
+			const Metrics	&metrics;
+			Logger			&logger;
+			std::string		path;
+			int				listen_fd;
+			int				wakeFds[2];
+			pthread_t		thread;
+			bool			threadStarted;
+
+			MetricsEndpoint(const MetricsEndpoint&);
+			MetricsEndpoint& operator=(const MetricsEndpoint&);
+
+			void	openSocket();
+			void	serve();
+			void	answer(int fd);
+
+			static void	*threadMain(void *arg);
+
+	public:
+			MetricsEndpoint(const Metrics& metrics, Logger& logger, const std::string& path);
+			~MetricsEndpoint();
+
+			void	start();
+			void	stop();
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef MPSCQUEUE_HPP
+#define MPSCQUEUE_HPP
+
+#include <cstddef>
+
+// Unbounded multi-producer / single-consumer queue (Vyukov). push() is
+// wait-free and may be called from any thread; pop() must only be called by
+// the owning thread. Items pushed by one producer come out in push order.
+template <typename T>
+class MpscQueue
+{
+	private:
+			struct Node
+			{
+				Node	*next;
+				T		value;
+			};
+
+			Node	*head;
+			Node	*tail;
+
+			MpscQueue(const MpscQueue&);
+			MpscQueue& operator=(const MpscQueue&);
+
+	public:
+			MpscQueue()
+			{
+				Node *stub = new Node();
+				stub->next = NULL;
+				head = stub;
+				tail = stub;
+			}
+
+			~MpscQueue()
+			{
+				T discarded;
+				while (pop(discarded))
+					;
+				delete tail;
+			}
+
+			void push(const T& value)
+			{
+				Node *node = new Node();
+				node->next = NULL;
+				node->value = value;
+				Node *prev = __atomic_exchange_n(&head, node, __ATOMIC_ACQ_REL);
+				__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+			}
+
+			bool pop(T& out)
+			{
+				Node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+				if (next == NULL)
+					return false;
+				out = next->value;
+				next->value = T();
+				delete tail;
+				tail = next;
+				return true;
+			}
+};
+
+#endif
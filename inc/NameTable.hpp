@@ -0,0 +1,66 @@
+#ifndef NAMETABLE_HPP
+#define NAMETABLE_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <tr1/unordered_map>
+
+typedef unsigned int nameId;
+
+// Interned nick and channel names. Each distinct name, compared under RFC
+// 1459 casemapping, is stored once in folded form together with its hash and
+// given a small integer id, so tables can be keyed by id and two names
+// compared with ==. Entries are reference counted and their ids reused once
+// released. Names are hashed with SipHash under a key chosen at startup, so
+// clients cannot pick nicknames that all land in one bucket.
+class NameTable
+{
+	private:
+			struct nameKey
+			{
+				std::string	folded;
+				size_t		hash;
+
+				bool operator==(const nameKey& other) const;
+			};
+
+			struct keyHash
+			{
+				size_t operator()(const nameKey& key) const;
+			};
+
+			struct entry
+			{
+				nameKey		key;
+				unsigned	refs;
+			};
+
+			unsigned long long	k0;
+			unsigned long long	k1;
+			std::vector<entry>	entries;
+			std::vector<nameId>	freeIds;
+			std::tr1::unordered_map<nameKey, nameId, keyHash>	index;
+			mutable nameKey		scratch;
+
+			NameTable(const NameTable&);
+			NameTable& operator=(const NameTable&);
+
+			void	seed();
+			void	makeKey(const std::string& name, nameKey& key) const;
+
+	public:
+			static const nameId	NONE = 0;
+
+			NameTable();
+
+			nameId	find(const std::string& name) const;
+			nameId	acquire(const std::string& name);
+			void	release(nameId id);
+			size_t	size() const;
+
+			static char	fold(char c);
+			static bool	equal(const std::string& a, const std::string& b);
+};
+
+#endif
@@ -2,46 +2,34 @@
 #define PARSER_HPP
 
 #include <string>
-#include <sstream>
-#include <vector>
+#include "LineBuffer.hpp"
 
-struct userInfo
+// One IRC message (RFC 1459 with optional IRCv3 tags) as views into the line
+// it was parsed from, so the views are only valid as long as that line is.
+// A trailing parameter is also stored as the last entry of params, which
+// lets handlers index parameters the same way whether or not it had a ':'.
+struct ircMessage
 {
-	std::string userName;
-	std::string realName;
-};
-
-struct reciveMessage
-{
-	std::string target;
-	std::string message;
-};
-
-struct parseInfo
-{
-	std::string command;
-	std::string function;
-	std::string value;
-};
-
-struct modeInfo
-{
-	std::string channel;
-	bool status;
-	std::string key;
-	std::string parameters;
+	static const size_t	MAX_PARAMS = 15;
+
+	lineView	tags;
+	lineView	prefix;
+	lineView	command;
+	lineView	params[MAX_PARAMS];
+	size_t		paramCount;
+	lineView	trailing;
+	bool		hasTrailing;
 };
 
 class Parser
 {
 	public:
-		static reciveMessage privateMessage(std::string message);
-		static parseInfo parse(std::string  message);
-		static userInfo userParse(std::string message);
-		static modeInfo modeParse(std::string message);
+		static bool parse(const char *data, size_t size, ircMessage& out);
 };
 
-std::vector<std::string> split(const std::string& s);
-std::string trim(const std::string& str);
+std::string toString(const lineView& view);
+bool equals(const lineView& view, const char *str);
+bool equals(const lineView& view, const std::string& str);
+bool nextItem(const lineView& list, size_t& pos, lineView& item);
 
 #endif
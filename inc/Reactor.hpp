@@ -0,0 +1,82 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <string>
+#include <vector>
+#include <poll.h>
+#ifdef __linux__
+# include <sys/epoll.h>
+#endif
+
+struct reactorEvent
+{
+	int		fd;
+	void	*data;
+	bool	readable;
+	bool	writable;
+	bool	hangup;
+};
+
+// Readiness notification backend used by Server::run. Registration carries an
+// opaque pointer that is handed back with every event so the loop never has to
+// look the fd up again.
+class Reactor
+{
+	public:
+			enum
+			{
+				READ = 1,
+				WRITE = 2,
+				EDGE = 4
+			};
+
+			virtual ~Reactor();
+			virtual void		add(int fd, int events, void *data) = 0;
+			virtual void		modify(int fd, int events, void *data) = 0;
+			virtual void		remove(int fd) = 0;
+			virtual int			wait(std::vector<reactorEvent>& out, int timeout) = 0;
+			virtual std::string	getName() const = 0;
+
+			static Reactor		*create(const std::string& backend);
+};
+
+// Portable fallback: one pollfd array, kept dense by swapping the last entry
+// into the hole on removal.
+class PollReactor : public Reactor
+{
+	private:
+			std::vector<struct pollfd>	fds;
+			std::vector<void *>			data;
+			std::vector<int>			slots;
+
+	public:
+			PollReactor();
+			~PollReactor();
+			void		add(int fd, int events, void *data);
+			void		modify(int fd, int events, void *data);
+			void		remove(int fd);
+			int			wait(std::vector<reactorEvent>& out, int timeout);
+			std::string	getName() const;
+};
+
+#ifdef __linux__
+
+class EpollReactor : public Reactor
+{
+	private:
+			int								epfd;
+			std::vector<struct epoll_event>	events;
+
+	public:
+			EpollReactor();
+			~EpollReactor();
+			void		add(int fd, int events, void *data);
+			void		modify(int fd, int events, void *data);
+			void		remove(int fd);
+			int			wait(std::vector<reactorEvent>& out, int timeout);
+			std::string	getName() const;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef REPLY_HPP
+#define REPLY_HPP
+
+#include <string>
+#include <cstddef>
+
+// Builds one outgoing line in a string owned by the caller. Numerics start
+// with the configured server name and take their closing text from a single
+// table, and numbers are formatted in place, so once the string has
+// LINE_LIMIT bytes reserved building a reply never allocates. Lines longer
+// than LINE_LIMIT are cut short before the CRLF.
+class Reply
+{
+	private:
+			std::string&	out;
+			std::string		serverName;
+			const char		*closing;
+
+			Reply(const Reply&);
+			Reply& operator=(const Reply&);
+
+	public:
+			static const size_t	LINE_LIMIT = 512;
+
+			enum replyCode
+			{
+				RPL_WELCOME = 1,
+				RPL_STATSCOMMANDS = 212,
+				RPL_ENDOFSTATS = 219,
+				RPL_STATSUPTIME = 242,
+				RPL_STATSDEBUG = 249,
+				RPL_CHANNELMODEIS = 324,
+				RPL_TOPIC = 332,
+				RPL_TOPICWHOTIME = 333,
+				RPL_INVITING = 341,
+				RPL_NAMREPLY = 353,
+				RPL_ENDOFNAMES = 366,
+				RPL_YOUREOPER = 381,
+				ERR_NOSUCHNICK = 401,
+				ERR_NOSUCHCHANNEL = 403,
+				ERR_NORECIPIENT = 411,
+				ERR_UNKNOWNCOMMAND = 421,
+				ERR_NONICKNAMEGIVEN = 431,
+				ERR_ERRONEUSNICKNAME = 432,
+				ERR_NICKNAMEINUSE = 433,
+				ERR_USERNOTINCHANNEL = 441,
+				ERR_NOTONCHANNEL = 442,
+				ERR_USERONCHANNEL = 443,
+				ERR_NOTREGISTERED = 451,
+				ERR_NEEDMOREPARAMS = 461,
+				ERR_ALREADYREGISTRED = 462,
+				ERR_PASSWDMISMATCH = 464,
+				ERR_CHANNELISFULL = 471,
+				ERR_UNKNOWNMODE = 472,
+				ERR_INVITEONLYCHAN = 473,
+				ERR_BADCHANNELKEY = 475,
+				ERR_NOPRIVILEGES = 481,
+				ERR_CHANOPRIVSNEEDED = 482,
+				ERR_NOOPERHOST = 491,
+				ERR_INVALIDMODEPARAM = 696
+			};
+
+			Reply(std::string& out, const std::string& serverName);
+
+			Reply&	numeric(replyCode code, const std::string& target);
+			Reply&	command(const char *command);
+			Reply&	command(const std::string& source, const char *command);
+			Reply&	notice(const std::string& target);
+			Reply&	param(const std::string& value);
+			Reply&	param(const char *value);
+			Reply&	param(const char *value, size_t len);
+			Reply&	param(long value);
+			Reply&	trailing();
+			Reply&	trailing(const std::string& text);
+			Reply&	trailing(const char *text);
+			Reply&	trailing(const char *text, size_t len);
+			Reply&	append(const std::string& text);
+			Reply&	append(const char *text);
+			Reply&	append(const char *text, size_t len);
+			Reply&	append(char c);
+			const std::string&	end();
+
+			const std::string&	getServerName() const;
+
+			static const char	*text(replyCode code);
+			static void			appendNumber(std::string& out, long value);
+};
+
+#endif
@@ -13,12 +13,24 @@
 #include <poll.h>
 #include <map>
 #include "Client.hpp"
+#include "ClientTable.hpp"
+#include "NameTable.hpp"
 #include "Channel.hpp"
 #include "Parser.hpp"
 #include "Commands.hpp"
+#include "Config.hpp"
+#include "Reactor.hpp"
+#include "Shard.hpp"
+#include "Metrics.hpp"
+#include "Logger.hpp"
+#include "Tracer.hpp"
+#include "Capture.hpp"
+#include "MetricsEndpoint.hpp"
+#include <pthread.h>
 #include <cstdlib>
 #include <cctype>
 #include <sstream>
+#include <tr1/unordered_map>
 
 #define GREEN "\033[1;32m"
 #define YELLOW "\033[1;33m"
@@ -37,24 +49,64 @@ class Commands;
 class Server
 {
 	private:
-			int								server_fd;
+			Logger							logger; // first in, last out, so everything else can log
 			std::string						pwd;
-			std::vector<struct pollfd>		fds;
-			std::map<int, Client>			clients;
-			std::map<std::string, Channel>	channels;
-			std::vector<std::string>		nickList;
+			Metrics							metrics;
+			Tracer							tracer;
+			MetricsEndpoint					*metricsEndpoint;
+			Capture							*capture;
+			std::vector<Shard *>			shards;
+			ClientTable						clients;
+			NameTable						names;
+			channelMap						channels;
+			std::tr1::unordered_map<nameId, Client *>	nicks;
+			Commands						*commands;
+			pthread_mutex_t					stateLock;
+			Shard							*activeShard;
+			unsigned long					nextClientId;
+			int								stopping;
+			std::string						failure;
+
+			static int						pendingSignal;
+			static int						signalWakeFd;
+
+			Server(const Server&);
+			Server& operator=(const Server&);
 
 			bool checkPort(const std::string& port);
-			void initServer(const std::string& port);
-			void handleClientMessage(Client& client, std::string& line);
+			void destroyShards();
 
 	public:
-			Server(const std::string& port, const std::string& pwd);
+			Server(const serverConfig& config);
 			~Server();
 			void run();
-			bool addNick(std::string& nick);
+			void stop(const std::string& reason);
+			bool isStopping() const;
+			void checkSignals();
+			static void notifySignal(int signal);
+
+			void lockState(Shard *shard);
+			void unlockState();
+			Client *registerClient(int fd, int shard);
+			void unregisterClient(Client& client);
+			void handleClientMessage(Client& client, const lineView& line);
+			void handleClientMessage(Client& client, const std::string& line);
+			void dispatchMessage(Client& client, const ircMessage *msg, size_t size);
+			Commands *makeCommands(const serverConfig& config);
+
+			Shard& getShard(int id);
+			Metrics& getMetrics();
+			Logger& getLogger();
+			Tracer& getTracer();
+			Capture *getCapture();
+			bool dumpTrace(std::string& result);
+
+			bool setNick(Client& client, const std::string& nick);
+			Client *findClient(const std::string& nick);
+			void queueMessage(int fd, const std::string& msg);
+			void queueMessage(int fd, const MessageBuffer& msg);
 			
-			void removeNick(std::string nick);
+			void removeNick(Client& client);
 };
 
 #endif
@@ -0,0 +1,69 @@
+#ifndef SERVICE_HPP
+#define SERVICE_HPP
+
+#include <string>
+#include "Client.hpp"
+#include "NameTable.hpp"
+
+class Channel;
+
+// Something a command did that services may want to react to. The client is
+// named by fd and id so a service can tell if it is gone by the time the
+// event is handled.
+struct serviceEvent
+{
+	enum kind
+	{
+		JOIN = 1,
+		PART = 2,
+		MESSAGE = 4,
+		NICK = 8
+	};
+
+	kind			type;
+	int				fd;
+	unsigned long	clientId;
+	nameId			channel; // NONE for private messages and NICK
+	std::string		text; // message text, or the previous nickname for NICK
+};
+
+// What a service may do to the server. Implemented by the command layer,
+// which announces every change the same way it does for a client.
+class ServiceHost
+{
+	public:
+			virtual ~ServiceHost();
+
+			virtual bool	registerService(Client& service, const std::string& nickname) = 0;
+			virtual Client	*findClient(int fd, unsigned long id) = 0;
+			virtual Channel	*findChannel(nameId id) = 0;
+			virtual void	serviceJoin(Client& service, Channel& channel) = 0;
+			virtual void	serviceMessage(Client& service, Channel& channel, const std::string& text) = 0;
+			virtual void	serviceNotice(Client& service, const Client& target, const std::string& text) = 0;
+			virtual void	serviceOp(Client& service, Channel& channel, const Client& target) = 0;
+};
+
+// A bot that lives inside the server. It has a Client of its own, with a
+// negative fd since there is no socket behind it, subscribes to event kinds
+// and is only called once the command that caused an event has finished.
+class Service
+{
+	private:
+			Service(const Service&);
+			Service& operator=(const Service&);
+
+	protected:
+			Client	client;
+
+	public:
+			Service(int fd);
+			virtual ~Service();
+
+			Client&	getClient();
+
+			virtual int		subscriptions() const = 0;
+			virtual bool	start(ServiceHost& host) = 0;
+			virtual void	handle(const serviceEvent& event, ServiceHost& host) = 0;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SERVICEBUS_HPP
+#define SERVICEBUS_HPP
+
+#include <vector>
+#include "Service.hpp"
+
+// Routes command events to the services subscribed to them. Commands only
+// queue events, and only kinds somebody listens to, so a command pays for
+// the bots once it is done rather than inline. A bus without services
+// queues nothing, which takes them out of the command path entirely.
+class ServiceBus
+{
+	private:
+			std::vector<Service *>		services;
+			std::vector<serviceEvent>	pending;
+			std::vector<serviceEvent>	running;
+			int							subscribed;
+
+			ServiceBus(const ServiceBus&);
+			ServiceBus& operator=(const ServiceBus&);
+
+	public:
+			ServiceBus();
+			~ServiceBus();
+
+			void	add(Service *service);
+			void	start(ServiceHost& host);
+			bool	wants(serviceEvent::kind type) const;
+			void	publish(serviceEvent::kind type, const Client& client, nameId channel, const std::string& text = "");
+			void	dispatch(ServiceHost& host);
+			Client	*findClient(int fd);
+};
+
+#endif
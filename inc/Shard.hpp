@@ -0,0 +1,136 @@
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "Reactor.hpp"
+#include "MpscQueue.hpp"
+#include "Config.hpp"
+#include "MessageBuffer.hpp"
+#include "Uring.hpp"
+#include "Metrics.hpp"
+#include "Logger.hpp"
+#include "Tracer.hpp"
+#include "Parser.hpp"
+
+class Server;
+class Client;
+
+// A framed line and its parse, both made before the state lock is taken.
+struct parsedLine
+{
+	lineView	line;
+	ircMessage	msg;
+	bool		valid;
+};
+
+struct outboundMessage
+{
+	int				fd;
+	unsigned long	clientId;
+	MessageBuffer	data;
+};
+
+#ifdef __linux__
+// Book-keeping for a client socket driven by io_uring. The descriptor stays
+// open after the client is gone until every operation that references it or
+// its send buffers has completed, so the fd number cannot be reused early.
+struct uringSlot
+{
+	unsigned long				clientId;
+	int							inflight;
+	int							sends;
+	bool						retired;
+	bool						failed;
+	size_t						retainedOffset;
+	std::deque<MessageBuffer>	retained;
+};
+#endif
+
+// One event loop. A shard owns its listener, its reactor and the I/O side of
+// every client it accepted: only the shard's own thread reads from or writes
+// to those sockets and their buffers. Protocol state (nicknames, channels) is
+// shared and is only touched while holding the server state lock. Output for
+// a client owned by another shard is handed over through that shard's inbox.
+class Shard
+{
+	private:
+			Server								&server;
+			Metrics								&metrics;
+			Logger								&logger;
+			Tracer								&tracer;
+			int									id;
+			int									listen_fd;
+			int									reserved_fd;
+			int									acceptBudget;
+			int									wakeFds[2];
+			int									wakePending;
+			Reactor								*reactor;
+#ifdef __linux__
+			Uring								*uring;
+			std::vector<uringSlot>				slots;
+#endif
+			size_t								sendqLimit;
+			pthread_t							thread;
+			bool								threadStarted;
+			MpscQueue<outboundMessage>			inbox;
+			std::vector<Client *>				local;
+			std::vector<int>					pendingFlush;
+			std::vector<int>					pendingClose;
+			std::vector<parsedLine>				batch; // reused by processInput
+
+			Shard(const Shard&);
+			Shard& operator=(const Shard&);
+
+			void	openListener(const serverConfig& config);
+			void	acceptClients();
+			void	addClient(int fd);
+			void	shedConnection();
+			void	reserveFd();
+			bool	readFromClient(Client& client);
+			void	processInput(Client& client);
+			void	disconnectClient(Client& client);
+			void	closeClient(Client& client, const std::string& reason);
+			void	flushClient(Client& client);
+			void	processPendingOutput();
+			void	handleWake();
+			Client	*findLocal(int fd) const;
+			void	endIteration(unsigned long long waited, unsigned long long start, unsigned long long flushed);
+			void	runReactor();
+
+#ifdef __linux__
+			void	runUring();
+			void	armAccept();
+			void	armWake();
+			void	armRecv(Client& client);
+			void	submitSends(Client& client);
+			void	handleCompletion(const struct io_uring_cqe& cqe);
+			void	onRecv(int fd, unsigned long clientId, const struct io_uring_cqe& cqe);
+			void	onSend(int fd, unsigned long clientId, int res);
+			void	retireFd(int fd);
+			void	submitRetained(int fd);
+			void	releaseRetired(int fd);
+			Client	*findUringClient(int fd, unsigned long clientId) const;
+#endif
+
+			static void	*threadMain(void *arg);
+
+	public:
+			Shard(Server& server, int id, const serverConfig& config);
+			~Shard();
+
+			void	run();
+			void	start();
+			void	join();
+			void	wake();
+			int		getWakeFd() const;
+			int		getId() const;
+
+			void	drainInbox();
+			void	deliver(Client& client, const MessageBuffer& msg);
+			void	post(int fd, unsigned long clientId, const MessageBuffer& msg);
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "Config.hpp"
+#include "Logger.hpp"
+
+// Opt-in timeline of where each event loop spends its time: every loop
+// phase and every command, with begin and end times. Each shard writes only
+// its own fixed ring, so recording is a few stores and the oldest events
+// are overwritten once a ring is full. dump() copies the rings and a thread
+// of its own writes them as Chrome trace-event JSON (chrome://tracing,
+// Perfetto), so the loops only wait for the copy. It runs on request, either
+// from SIGUSR1 or STATS t. The writers are not stopped for it; events that
+// may have been overwritten while a ring was copied are left out.
+class Tracer
+{
+	public:
+			static const size_t	CHANNEL_SIZE = 32;
+
+			struct event
+			{
+				unsigned long long	begin;
+				unsigned long long	end;
+				const char			*name; // a string literal
+				int					fd; // -1 for loop phases
+				unsigned			fanout;
+				char				channel[CHANNEL_SIZE];
+			};
+
+	private:
+			struct ring
+			{
+				std::vector<event>	events;
+				unsigned long		next;
+				char				pad[64];
+			};
+
+			// What one dump writes: each ring's copy and the indexes in it
+			// that were complete.
+			struct copy
+			{
+				std::vector<event>	events;
+				unsigned long		first;
+				unsigned long		last;
+			};
+
+			Logger				&logger;
+			std::vector<ring>	rings;
+			size_t				capacity;
+			std::string			path;
+			unsigned long long	origin;
+			std::vector<copy>	copies;
+			pthread_t			writer;
+			bool				writerStarted;
+			int					writing;
+
+			static int			dumpRequested;
+
+			Tracer(const Tracer&);
+			Tracer& operator=(const Tracer&);
+
+			void	write();
+
+			static void	*writerMain(void *arg);
+
+	public:
+			Tracer(const serverConfig& config, Logger& logger);
+			~Tracer();
+
+			bool	enabled() const
+			{
+				return capacity != 0;
+			}
+
+			void	record(int thread, const char *name, unsigned long long begin, unsigned long long end,
+						int fd = -1, const char *channel = NULL, size_t channelLen = 0, size_t fanout = 0);
+			bool	dump(std::string& result);
+
+			// Safe to call from a signal handler; one of the loops picks the
+			// request up once it wakes.
+			static void	requestDump();
+			static bool	takeDumpRequest();
+};
+
+#endif
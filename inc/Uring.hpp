@@ -0,0 +1,67 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <cstddef>
+
+// Minimal io_uring wrapper over the raw syscalls: one submission and one
+// completion ring plus a registered ring of provided receive buffers that
+// multishot recv picks from.
+class Uring
+{
+	private:
+			int						ringFd;
+			void					*sqRing;
+			size_t					sqRingSize;
+			void					*cqRing;
+			size_t					cqRingSize;
+			struct io_uring_sqe		*sqes;
+			size_t					sqesSize;
+			unsigned				*sqHead;
+			unsigned				*sqTail;
+			unsigned				*sqArray;
+			unsigned				*sqFlags;
+			unsigned				sqMask;
+			unsigned				sqEntries;
+			unsigned				*cqHead;
+			unsigned				*cqTail;
+			unsigned				cqMask;
+			struct io_uring_cqe		*cqes;
+			unsigned				localTail;
+			unsigned				submitted;
+
+			struct io_uring_buf		*bufRing;
+			size_t					bufRingSize;
+			char					*bufPool;
+			unsigned				bufCount;
+			unsigned				bufSize;
+			unsigned short			bufTail;
+
+			Uring(const Uring&);
+			Uring& operator=(const Uring&);
+
+			void	setupRings(unsigned entries);
+			void	setupBuffers();
+			void	release();
+
+	public:
+			static const unsigned short	BUFFER_GROUP = 0;
+
+			Uring(unsigned entries, unsigned bufCount, unsigned bufSize);
+			~Uring();
+
+			struct io_uring_sqe	*getSqe();
+			void				reserve(unsigned count);
+			void				submit(bool wait);
+			bool				nextCompletion(struct io_uring_cqe& out);
+			char				*buffer(unsigned bid) const;
+			void				recycle(unsigned bid);
+
+			static bool			isSupported();
+};
+
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+#include "Capture.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+#define RED "\033[1;31m"
+#define RESET "\033[0m"
+
+const char Capture::MAGIC[9] = "IRCCAP1\n";
+
+static unsigned long long nowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<unsigned long long>(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// The file holds passwords and private messages, so only the owner may read
+// it.
+Capture::Capture(Logger& logger, const std::string& path)
+	: logger(logger), path(path), buffer(MAGIC, sizeof(MAGIC) - 1), last(nowUs()), failed(false), stopping(false), writeFailed(0)
+{
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1)
+		throw std::runtime_error(RED"Error: could not open capture file " + path + ": " + strerror(errno) + RESET);
+	pthread_mutex_init(&queueLock, NULL);
+	pthread_cond_init(&queueReady, NULL);
+	if (pthread_create(&writer, NULL, &Capture::writerMain, this) != 0)
+	{
+		pthread_cond_destroy(&queueReady);
+		pthread_mutex_destroy(&queueLock);
+		::close(fd);
+		throw std::runtime_error(RED"Error: could not start capture thread" RESET);
+	}
+	flush();
+}
+
+// What is left in the buffer is queued regardless of the limit, and the
+// writer empties the queue before it exits.
+Capture::~Capture()
+{
+	pthread_mutex_lock(&queueLock);
+	if (!failed && !buffer.empty())
+	{
+		queue.push_back(std::string());
+		queue.back().swap(buffer);
+	}
+	stopping = true;
+	pthread_cond_signal(&queueReady);
+	pthread_mutex_unlock(&queueLock);
+	pthread_join(writer, NULL);
+	pthread_cond_destroy(&queueReady);
+	pthread_mutex_destroy(&queueLock);
+	::close(fd);
+}
+
+void Capture::putVarint(unsigned long long value)
+{
+	while (value >= 0x80)
+	{
+		buffer += static_cast<char>((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	buffer += static_cast<char>(value);
+}
+
+void Capture::begin(captureRecord::kind type, unsigned long connection)
+{
+	unsigned long long now = nowUs();
+	buffer += static_cast<char>(type);
+	putVarint(connection);
+	putVarint(now - last);
+	last = now;
+}
+
+void Capture::connected(unsigned long connection)
+{
+	if (failed)
+		return;
+	begin(captureRecord::OPEN, connection);
+}
+
+void Capture::received(unsigned long connection, const lineView& line)
+{
+	if (failed)
+		return;
+	begin(captureRecord::LINE, connection);
+	putVarint(line.size);
+	buffer.append(line.data, line.size);
+	if (buffer.size() >= FLUSH_SIZE)
+		flush();
+}
+
+void Capture::disconnected(unsigned long connection)
+{
+	if (failed)
+		return;
+	begin(captureRecord::CLOSE, connection);
+}
+
+// Hands the buffer to the writer thread. Only the swap happens here, under
+// the state lock; the write does not.
+void Capture::flush()
+{
+	if (__atomic_load_n(&writeFailed, __ATOMIC_ACQUIRE))
+		failed = true;
+	pthread_mutex_lock(&queueLock);
+	if (!failed && queue.size() >= QUEUE_LIMIT)
+	{
+		logger.log(Logger::WARN, Logger::SERVER, "capture to %s stopped: the disk is not keeping up", path.c_str());
+		failed = true;
+	}
+	if (!failed)
+	{
+		queue.push_back(std::string());
+		queue.back().swap(buffer);
+		pthread_cond_signal(&queueReady);
+	}
+	pthread_mutex_unlock(&queueLock);
+	buffer.clear();
+	buffer.reserve(FLUSH_SIZE * 2);
+}
+
+bool Capture::write(const std::string& data)
+{
+	size_t written = 0;
+	while (written < data.size())
+	{
+		ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		written += n;
+	}
+	return true;
+}
+
+void *Capture::writerMain(void *arg)
+{
+	static_cast<Capture *>(arg)->run();
+	return NULL;
+}
+
+void Capture::run()
+{
+	std::string data;
+
+	pthread_mutex_lock(&queueLock);
+	while (true)
+	{
+		while (queue.empty() && !stopping)
+			pthread_cond_wait(&queueReady, &queueLock);
+		if (queue.empty())
+			break;
+		data.swap(queue.front());
+		queue.pop_front();
+		pthread_mutex_unlock(&queueLock);
+
+		if (!__atomic_load_n(&writeFailed, __ATOMIC_ACQUIRE) && !write(data))
+		{
+			logger.log(Logger::WARN, Logger::SERVER, "capture to %s stopped: %s", path.c_str(), strerror(errno));
+			__atomic_store_n(&writeFailed, 1, __ATOMIC_RELEASE);
+		}
+		data.clear();
+		pthread_mutex_lock(&queueLock);
+	}
+	pthread_mutex_unlock(&queueLock);
+}
+
+CaptureReader::CaptureReader(const std::string& path) : pos(sizeof(Capture::MAGIC) - 1), time(0)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		throw std::runtime_error(RED"Error: could not open capture file " + path + ": " + strerror(errno) + RESET);
+	char chunk[65536];
+	ssize_t n;
+	while ((n = read(fd, chunk, sizeof(chunk))) != 0)
+	{
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			std::string err = strerror(errno);
+			::close(fd);
+			throw std::runtime_error(RED"Error: could not read capture file " + path + ": " + err + RESET);
+		}
+		data.insert(data.end(), chunk, chunk + n);
+	}
+	::close(fd);
+	if (data.size() < pos || std::memcmp(&data[0], Capture::MAGIC, pos) != 0)
+		throw std::runtime_error(RED"Error: " + path + " is not a capture file" RESET);
+}
+
+bool CaptureReader::getVarint(unsigned long long& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64 && pos < data.size(); shift += 7)
+	{
+		unsigned char byte = data[pos++];
+		value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+// A capture cut short by a crash ends in a partial record, which is left
+// out; everything before it is still returned.
+bool CaptureReader::next(captureRecord& out)
+{
+	if (pos >= data.size())
+		return false;
+	unsigned char type = data[pos++];
+	if (type < captureRecord::OPEN || type > captureRecord::CLOSE)
+		throw std::runtime_error(RED"Error: corrupt capture file" RESET);
+
+	unsigned long long connection;
+	unsigned long long delta;
+	unsigned long long size = 0;
+	if (!getVarint(connection) || !getVarint(delta)
+		|| (type == captureRecord::LINE && (!getVarint(size) || size > data.size() - pos)))
+	{
+		pos = data.size();
+		return false;
+	}
+	out.type = static_cast<captureRecord::kind>(type);
+	out.connection = connection;
+	time += delta;
+	out.time = time;
+	out.line.assign(data.begin() + pos, data.begin() + pos + size);
+	pos += size;
+	return true;
+}
@@ -1,34 +1,42 @@
 #include "Channel.hpp"
-#include "Client.hpp"
-#include <sys/socket.h>
+#include <cstdlib>
+
+// How long an INVITE lets its target past +i.
+static const std::time_t INVITE_LIFETIME = 3600;
 
 Channel::Channel()
 {
 	this->name = "";
-	this->pwd = "";
-	this->invOnly = false;
-	this->maxUsers = -1;
+	this->id = NameTable::NONE;
+	this->modes = 0;
+	this->limit = 0;
+	this->namesBudget = 0;
+	this->serviceCount = 0;
+	this->namesValid = true;
 	this->topic = "The topic has not been set yet.";
-	this->topicSet = true;
 }
 
-Channel::Channel(const std::string& name)
+// namesBudget is how many bytes of names fit in one 353 line for this
+// channel; the caller works it out from the line limit.
+Channel::Channel(const std::string& name, nameId id, size_t namesBudget)
 {
 	this->name = name;
-	this->pwd = "";
-	this->invOnly = false;
-	this->maxUsers = -1;
+	this->id = id;
+	this->modes = 0;
+	this->limit = 0;
+	this->namesBudget = namesBudget;
+	this->serviceCount = 0;
+	this->namesValid = true;
 	this->topic = "The topic has not been set yet.";
-	this->topicSet = true;
 }
 
 Channel::~Channel()
 {
-	users.clear();
-	ops.clear();
-	invitedUsers.clear();
+	members.clear();
+	memberIndex.clear();
+	invites.clear();
 	this->name.clear();
-	this->pwd.clear();
+	this->key.clear();
 	this->topic.clear();
 }
 
@@ -37,81 +45,131 @@ void Channel::setName(const std::string& name)
 	this->name = name;
 }
 
-void Channel::setPwd(const std::string& pwd)
+void Channel::setMode(unsigned mode, bool on)
 {
-	this->pwd = pwd;
+	if (on)
+		this->modes |= mode;
+	else
+		this->modes &= ~mode;
 }
 
-void Channel::setInvOnly(const bool& invOnly)
+void Channel::setKey(const std::string& key)
 {
-	this->invOnly = invOnly;
+	this->key = key;
+	setMode(MODE_KEY, !key.empty());
 }
 
-void Channel::setMaxUsers(const int& maxUsers)
+void Channel::setLimit(size_t limit)
 {
-	this->maxUsers = maxUsers;
+	this->limit = limit;
+	setMode(MODE_LIMIT, true);
 }
 
-bool Channel::getInvOnly() const
+bool Channel::hasMode(unsigned mode) const
 {
-	return (this->invOnly);
+	return (this->modes & mode) != 0;
 }
 
-int Channel::getMaxUsers() const
+const std::string& Channel::getKey() const
 {
-	return (this->maxUsers);
+	return (this->key);
 }
 
-void Channel::addOp(const std::string& op)
+size_t Channel::getLimit() const
 {
-	ops.push_back(op);
+	return (this->limit);
 }
 
-std::string Channel::getName() const
+// Mode letters in the order MODE queries have always listed them.
+std::string Channel::getModeString() const
 {
-	return (this->name);
+	std::string letters;
+	if (hasMode(MODE_INVITE))
+		letters += "i";
+	if (hasMode(MODE_KEY))
+		letters += "k";
+	if (hasMode(MODE_LIMIT))
+		letters += "l";
+	if (hasMode(MODE_TOPIC))
+		letters += "t";
+	return letters;
 }
 
-std::string Channel::getPwd() const
+bool Channel::isFull() const
 {
-	return (this->pwd);
+	return hasMode(MODE_LIMIT) && members.size() >= limit;
 }
 
-void Channel::addUser(const Client& user)
+const std::string& Channel::getName() const
 {
-	for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
-		if (it->getFd() == user.getFd())
-			return;
-	users.push_back(user);
+	return (this->name);
 }
 
+nameId Channel::getId() const
+{
+	return (this->id);
+}
 
-void Channel::removeUser(const Client& user)
+// nickname only feeds the cached NAMES list, which a join extends in place.
+bool Channel::addMember(int fd, unsigned flags, const std::string& nickname)
 {
-	std::vector<Client>::iterator it = users.begin();
-	std::vector<Client>::iterator ite = users.end();
-	while (it != ite)
+	if (!memberIndex.insert(std::make_pair(fd, members.size())).second)
+		return false;
+
+	channelMember member;
+	member.fd = fd;
+	member.flags = flags;
+	member.chunk = 0;
+	members.push_back(member);
+	if (flags & channelMember::SERVICE)
+		serviceCount++;
+	if (namesValid)
+		appendName(members.size() - 1, nameEntry(nickname, flags));
+	return true;
+}
+
+// Swaps the last member into the freed slot. Returns the flags the member
+// had, or 0 if fd was not a member.
+unsigned Channel::removeMember(int fd, const std::string& nickname)
+{
+	std::tr1::unordered_map<int, size_t>::iterator it = memberIndex.find(fd);
+	if (it == memberIndex.end())
+		return 0;
+
+	size_t pos = it->second;
+	unsigned flags = members[pos].flags;
+	memberIndex.erase(it);
+	if (flags & channelMember::SERVICE)
+		serviceCount--;
+	if (namesValid && !eraseName(pos, nameEntry(nickname, flags)))
+		invalidateNames();
+	if (pos != members.size() - 1)
 	{
-		if (it->getFd() == user.getFd())
-		{
-			users.erase(it);
-			return;
-		}
-		++it;
+		members[pos] = members.back();
+		memberIndex[members[pos].fd] = pos;
 	}
+	members.pop_back();
+	return flags;
+}
+
+const std::vector<channelMember>& Channel::getMembers() const
+{
+	return (this->members);
 }
 
-std::vector<Client>& Channel::getUsers()
+size_t Channel::getMemberCount() const
 {
-	return (this->users);
+	return (this->members.size());
 }
 
-std::vector<std::string> &Channel::getOps()
+// Services stay in a channel as long as it exists, so a channel is only
+// alive while it has someone else in it.
+bool Channel::hasUsers() const
 {
-	return (this->ops);
+	return members.size() > serviceCount;
 }
 
-std::string Channel::getTopic() const
+const std::string& Channel::getTopic() const
 {
 	return (this->topic);
 }
@@ -121,75 +179,213 @@ void Channel::setTopic(const std::string& topic)
 	this->topic = topic;
 }
 
-std::vector<std::string>& Channel::getInvitedUsers()
+// Invites are keyed by client id rather than nickname, so a nick change
+// neither loses an invite nor hands it to whoever takes the old nick. Expired
+// entries are dropped here, since nothing else removes invites that are never
+// used.
+void Channel::addInvite(unsigned long clientId, std::time_t now)
 {
-	return (this->invitedUsers);
+	std::tr1::unordered_map<unsigned long, std::time_t>::iterator it = invites.begin();
+	while (it != invites.end())
+	{
+		if (it->second <= now)
+			it = invites.erase(it);
+		else
+			++it;
+	}
+	invites[clientId] = now + INVITE_LIFETIME;
+}
+
+bool Channel::isInvited(unsigned long clientId, std::time_t now)
+{
+	std::tr1::unordered_map<unsigned long, std::time_t>::iterator it = invites.find(clientId);
+	if (it == invites.end())
+		return false;
+	if (it->second <= now)
+	{
+		invites.erase(it);
+		return false;
+	}
+	return true;
+}
+
+void Channel::removeInvite(unsigned long clientId)
+{
+	invites.erase(clientId);
 }
 
-void Channel::addinvitedUser(const std::string& user)
+bool Channel::isOp(int fd) const
 {
-	if (std::find(invitedUsers.begin(), invitedUsers.end(), user) == invitedUsers.end())
-		invitedUsers.push_back(user);
+	std::tr1::unordered_map<int, size_t>::const_iterator it = memberIndex.find(fd);
+	return it != memberIndex.end() && (members[it->second].flags & channelMember::OP);
 }
 
-bool Channel::isOp(const std::string &nickName) const
+bool Channel::isService(int fd) const
 {
-	return (std::find(ops.begin(), ops.end(), nickName) != ops.end());
+	std::tr1::unordered_map<int, size_t>::const_iterator it = memberIndex.find(fd);
+	return it != memberIndex.end() && (members[it->second].flags & channelMember::SERVICE);
 }
 
-void Channel::removeOp(const std::string& op)
+void Channel::setOp(int fd, bool op, const std::string& nickname)
 {
-	std::vector<std::string>::iterator it = std::find(ops.begin(), ops.end(), op);
-	if (it == ops.end())
+	std::tr1::unordered_map<int, size_t>::iterator it = memberIndex.find(fd);
+	if (it == memberIndex.end())
 		return;
+	channelMember& member = members[it->second];
+	std::string oldEntry = nameEntry(nickname, member.flags);
+	if (op)
+		member.flags |= channelMember::OP;
+	else
+		member.flags &= ~channelMember::OP;
+	if (namesValid)
+		replaceName(it->second, oldEntry, nameEntry(nickname, member.flags));
+}
 
-	ops.erase(it);
-	if (ops.size() != 1)
+void Channel::renameMember(int fd, const std::string& oldNickname, const std::string& nickname)
+{
+	std::tr1::unordered_map<int, size_t>::iterator it = memberIndex.find(fd);
+	if (it == memberIndex.end() || !namesValid)
 		return;
+	unsigned flags = members[it->second].flags;
+	replaceName(it->second, nameEntry(oldNickname, flags), nameEntry(nickname, flags));
+}
 
-	std::vector<Client> newlist = users;
-	for (std::vector<Client>::iterator iter = newlist.begin(); iter != newlist.end(); ++iter)
+// Once no regular member is an operator any more, picks a random regular
+// member other than excludeFd to take over. Granting and announcing it is up
+// to the caller.
+bool Channel::pickOp(int excludeFd, int& chosen) const
+{
+	std::vector<size_t> candidates;
+	for (size_t i = 0; i < members.size(); ++i)
 	{
-		if (iter->getNickname() == op)
-		{
-			newlist.erase(iter);
-			break;
-		}
+		if (members[i].flags & channelMember::SERVICE)
+			continue;
+		if (members[i].flags & channelMember::OP)
+			return false;
+		if (members[i].fd != excludeFd)
+			candidates.push_back(i);
 	}
+	if (candidates.empty())
+		return false;
 
-	if (newlist.size() == 1)
-		return;
+	chosen = members[candidates[rand() % candidates.size()]].fd;
+	return true;
+}
+
+// The NAMES list is kept as ready-made chunks of "@nick nick ..." that each
+// fit in one 353 reply, and every member remembers its chunk. A join adds its
+// entry to the last chunk; a part, a prefix change or a nick change edits
+// only the chunk holding the member, moving the entry to the end if it no
+// longer fits. If an entry cannot be found the list is thrown away and the
+// next NAMES rebuilds it from the members.
+bool Channel::hasNames() const
+{
+	return namesValid;
+}
+
+const std::vector<std::string>& Channel::getNames() const
+{
+	return names;
+}
+
+void Channel::resetNames()
+{
+	names.clear();
+	namesValid = true;
+}
+
+void Channel::addName(int fd, const std::string& nickname)
+{
+	std::tr1::unordered_map<int, size_t>::iterator it = memberIndex.find(fd);
+	if (namesValid && it != memberIndex.end())
+		appendName(it->second, nameEntry(nickname, members[it->second].flags));
+}
+
+void Channel::invalidateNames()
+{
+	names.clear();
+	namesValid = false;
+}
+
+std::string Channel::nameEntry(const std::string& nickname, unsigned flags)
+{
+	if (flags & channelMember::OP)
+		return "@" + nickname;
+	if (flags & channelMember::VOICE)
+		return "+" + nickname;
+	return nickname;
+}
 
-	Client& newOpClient = newlist[rand() % newlist.size()];
-	while (newOpClient.getNickname() == "IrcBot")
-		newOpClient = newlist[rand() % newlist.size()];
-	
-	std::string newOp = newOpClient.getNickname();
-	ops.push_back(newOp);
-	std::string ModeMsg = ":Server MODE " + this->name + " +o " + newOp + "\r\n";
-	for (std::vector<Client>::iterator user = users.begin(); user != users.end(); ++user)
-		send(user->getFd(), ModeMsg.c_str(), ModeMsg.size(), 0);
+void Channel::appendName(size_t pos, const std::string& entry)
+{
+	if (names.empty() || names.back().size() + 1 + entry.size() > namesBudget)
+		names.push_back(std::string());
+	else
+		names.back() += ' ';
+	names.back() += entry;
+	members[pos].chunk = names.size() - 1;
 }
 
-bool Channel::getTopicSet() const
+// Where entry stands on its own in chunk, or npos.
+static size_t findEntry(const std::string& chunk, const std::string& entry)
 {
-	return this->topicSet;
+	size_t at = chunk.find(entry);
+	while (at != std::string::npos)
+	{
+		size_t end = at + entry.size();
+		if ((at == 0 || chunk[at - 1] == ' ') && (end == chunk.size() || chunk[end] == ' '))
+			return at;
+		at = chunk.find(entry, at + 1);
+	}
+	return std::string::npos;
 }
 
-void Channel::setTopicSet(const bool& topicSet)
+// Drops entry and one space next to it from the member's chunk. A chunk left
+// empty is removed, which moves every later chunk down by one.
+bool Channel::eraseName(size_t pos, const std::string& entry)
 {
-	this->topicSet = topicSet;
+	size_t index = members[pos].chunk;
+	if (index >= names.size())
+		return false;
+	std::string& chunk = names[index];
+	size_t at = findEntry(chunk, entry);
+	if (at == std::string::npos)
+		return false;
+
+	if (at != 0)
+		chunk.erase(at - 1, entry.size() + 1);
+	else if (entry.size() < chunk.size())
+		chunk.erase(at, entry.size() + 1);
+	else
+	{
+		names.erase(names.begin() + index);
+		for (size_t i = 0; i < members.size(); ++i)
+			if (members[i].chunk > index)
+				members[i].chunk--;
+	}
+	return true;
 }
 
-bool Channel::isUserInChannel(const std::string &check) const
+void Channel::replaceName(size_t pos, const std::string& oldEntry, const std::string& entry)
 {
-	std::vector<Client>::const_iterator it = users.begin();
-	std::vector<Client>::const_iterator ite = users.end();
-	while (it != ite)
+	size_t index = members[pos].chunk;
+	if (index < names.size())
 	{
-		if (it->getNickname() == check)
-			return true;
-		++it;
+		std::string& chunk = names[index];
+		size_t at = findEntry(chunk, oldEntry);
+		if (at != std::string::npos && chunk.size() - oldEntry.size() + entry.size() <= namesBudget)
+		{
+			chunk.replace(at, oldEntry.size(), entry);
+			return;
+		}
 	}
-	return false;
+	if (eraseName(pos, oldEntry))
+		appendName(pos, entry);
+	else
+		invalidateNames();
+}
+
+bool Channel::hasMember(int fd) const
+{
+	return memberIndex.find(fd) != memberIndex.end();
 }
@@ -1,11 +1,51 @@
 #include "Client.hpp"
+#include <sys/uio.h>
+#include <cerrno>
+
+// Upper bound on buffers handed to a single writev().
+static const int FLUSH_IOV = 64;
 
 
 Client::Client(const int& fd)
+{
+	reset(fd);
+}
+
+// Returns the client to its just-connected state under fd. Strings and
+// buffers are cleared rather than released, so a recycled Client reuses
+// their storage.
+void Client::reset(const int& fd)
 {
 	this->fd = fd;
+	this->id = 0;
+	this->shard = 0;
 	this->isAuth = false;
+	this->isOper = false;
+	this->sendOffset = 0;
+	this->sendQueueBytes = 0;
+	this->flushPending = false;
+	this->wantsWrite = false;
+	this->closing = false;
+	this->nickname.clear();
+	this->nickId = NameTable::NONE;
+	this->username.clear();
 	this->hostname = "server";
+	this->realname.clear();
+	this->servername.clear();
+	this->pwd.clear();
+	this->closeReason.clear();
+	this->input.clear();
+	this->sendQueue.clear();
+	this->joined_channels.clear();
+	updatePrefix();
+}
+
+// "nick!user@host", the source of every message the client sends to a
+// channel. Rebuilt whenever one of its parts changes rather than per message.
+void Client::updatePrefix()
+{
+	this->prefix.assign(this->nickname);
+	this->prefix.append(1, '!').append(this->username).append(1, '@').append(this->hostname);
 }
 
 Client::~Client()
@@ -16,16 +56,19 @@ Client::~Client()
 void Client::setNickname(const std::string& nickname)
 {
 	this->nickname = nickname;
+	updatePrefix();
 }
 
 void Client::setUsername(const std::string& username)
 {
 	this->username = username;
+	updatePrefix();
 }
 
 void Client::setHostname(const std::string& hostname)
 {
 	this->hostname = hostname;
+	updatePrefix();
 }
 
 void Client::setRealname(const std::string& realname)
@@ -43,81 +86,233 @@ int Client::getFd() const
 	return (this->fd);
 }
 
-std::string Client::getNickname() const
+unsigned long Client::getId() const
+{
+	return (this->id);
+}
+
+int Client::getShard() const
+{
+	return (this->shard);
+}
+
+void Client::setId(const unsigned long& id)
+{
+	this->id = id;
+}
+
+void Client::setShard(const int& shard)
+{
+	this->shard = shard;
+}
+
+const std::string& Client::getNickname() const
 {
 	return (this->nickname);
 }
 
-std::string Client::getUsername() const
+const std::string& Client::getPrefix() const
+{
+	return (this->prefix);
+}
+
+nameId Client::getNickId() const
+{
+	return (this->nickId);
+}
+
+void Client::setNickId(nameId nickId)
+{
+	this->nickId = nickId;
+}
+
+const std::string& Client::getUsername() const
 {
 	return (this->username);
 }
 
-std::string Client::getHostname() const
+const std::string& Client::getHostname() const
 {
 	return (this->hostname);
 }
 
-std::string Client::getRealname() const
+const std::string& Client::getRealname() const
 {
 	return (this->realname);
 }
 
-std::string Client::getServername() const
+const std::string& Client::getServername() const
 {
 	return (this->servername);
 }
 
-const std::vector<std::string>& Client::getJoinedChannels() const
+const std::vector<nameId>& Client::getJoinedChannels() const
 {
 	return (this->joined_channels);
 }
 
-void Client::joinChannel(const std::string& channel)
+void Client::joinChannel(nameId channel)
 {
 	if (std::find(joined_channels.begin(), joined_channels.end(), channel) == joined_channels.end())
 		joined_channels.push_back(channel);
 }
 
-void Client::partChannel(const std::string& channel)
+void Client::partChannel(nameId channel)
 {
-	std::vector<std::string>::iterator it = std::find(joined_channels.begin(), joined_channels.end(), channel);
+	std::vector<nameId>::iterator it = std::find(joined_channels.begin(), joined_channels.end(), channel);
 	if (it != joined_channels.end())
 		joined_channels.erase(it);
 }
 
-std::string& Client::getBuffer()
+LineBuffer& Client::getInput()
 {
-	return buffer;
+	return input;
 }
 
-void Client::appendToBuffer(const std::string& data)
+void Client::clearBuffer()
 {
-	buffer += data;
+	input.clear();
 }
 
-void Client::clearBuffer()
+void Client::queueMessage(const MessageBuffer& msg)
+{
+	if (msg.empty())
+		return;
+	sendQueue.push_back(msg);
+	sendQueueBytes += msg.size();
+}
+
+// Fills iov with up to max queued buffers, starting at the unsent part of
+// the front one. Returns the number of entries used.
+int Client::peekSendQueue(struct iovec *iov, int max) const
+{
+	int count = 0;
+
+	for (std::deque<MessageBuffer>::const_iterator it = sendQueue.begin(); it != sendQueue.end() && count < max; ++it, ++count)
+	{
+		size_t skip = (count == 0) ? sendOffset : 0;
+		iov[count].iov_base = const_cast<char *>(it->data() + skip);
+		iov[count].iov_len = it->size() - skip;
+	}
+	return count;
+}
+
+void Client::consumeSendQueue(size_t n)
+{
+	if (n > sendQueueBytes)
+		n = sendQueueBytes;
+	sendQueueBytes -= n;
+	while (n > 0)
+	{
+		size_t left = sendQueue.front().size() - sendOffset;
+		if (n < left)
+		{
+			sendOffset += n;
+			return;
+		}
+		n -= left;
+		sendQueue.pop_front();
+		sendOffset = 0;
+	}
+}
+
+// Hands the queued buffers to the caller, which keeps them alive while the
+// kernel may still be reading from them. Returns the offset already sent
+// from the first buffer.
+size_t Client::takeSendQueue(std::deque<MessageBuffer>& out)
 {
-	buffer.clear();
+	size_t offset = sendOffset;
+
+	out.swap(sendQueue);
+	sendQueue.clear();
+	sendOffset = 0;
+	sendQueueBytes = 0;
+	return offset;
 }
 
-bool Client::hasFullMessage(std::string& out)
+// Writes as much of the send queue as the socket accepts, gathering several
+// queued buffers per writev(). Returns false on a hard socket error; a
+// partial write simply leaves the rest queued.
+bool Client::flushSendQueue()
 {
-	size_t pos = buffer.find("\r\n");
-	if (pos == std::string::npos)
-		return false;
+	struct iovec iov[FLUSH_IOV];
+
+	while (!sendQueue.empty())
+	{
+		int count = peekSendQueue(iov, FLUSH_IOV);
+		size_t batch = 0;
+		for (int i = 0; i < count; i++)
+			batch += iov[i].iov_len;
+
+		ssize_t n = writev(fd, iov, count);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
 
-	out = buffer.substr(0, pos + 2);
-	buffer.erase(0, pos + 2);
+		consumeSendQueue(n);
+		if (static_cast<size_t>(n) < batch)
+			break;
+	}
 	return true;
 }
 
+size_t Client::getSendQueueSize() const
+{
+	return sendQueueBytes;
+}
+
+bool Client::hasPendingOutput() const
+{
+	return !sendQueue.empty();
+}
+
+bool Client::getFlushPending() const
+{
+	return this->flushPending;
+}
+
+void Client::setFlushPending(const bool& flushPending)
+{
+	this->flushPending = flushPending;
+}
+
+bool Client::getWantsWrite() const
+{
+	return this->wantsWrite;
+}
+
+void Client::setWantsWrite(const bool& wantsWrite)
+{
+	this->wantsWrite = wantsWrite;
+}
+
+void Client::markForClose(const std::string& reason)
+{
+	if (this->closing)
+		return;
+	this->closing = true;
+	this->closeReason = reason;
+}
+
+bool Client::isClosing() const
+{
+	return this->closing;
+}
+
+const std::string& Client::getCloseReason() const
+{
+	return this->closeReason;
+}
+
 void Client::setPwd(const std::string& pwd)
 {
 	this->pwd = pwd;
 }
 
-std::string Client::getPwd() const
+const std::string& Client::getPwd() const
 {
 	return this->pwd;
 }
@@ -132,6 +327,16 @@ void Client::setIsAuth(const bool& isAuth)
 	this->isAuth = isAuth;
 }
 
+bool Client::getIsOper() const
+{
+	return this->isOper;
+}
+
+void Client::setIsOper(const bool& isOper)
+{
+	this->isOper = isOper;
+}
+
 bool Client::isProvided() const
 {
 	return !this->nickname.empty() && !this->username.empty() && !this->realname.empty();
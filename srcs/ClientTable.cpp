@@ -0,0 +1,88 @@
+#include "ClientTable.hpp"
+#include <new>
+
+ClientTable::ClientTable() : constructed(0), count(0)
+{
+
+}
+
+ClientTable::~ClientTable()
+{
+	for (size_t i = 0; i < constructed; i++)
+		blocks[i / CLIENTS_PER_BLOCK][i % CLIENTS_PER_BLOCK].~Client();
+	for (size_t i = 0; i < blocks.size(); i++)
+		operator delete(blocks[i]);
+}
+
+// Takes an idle Client from the free list, or constructs the next one in the
+// current block, starting a new block when it is full.
+Client *ClientTable::allocate()
+{
+	if (!freeList.empty())
+	{
+		Client *client = freeList.back();
+		freeList.pop_back();
+		return client;
+	}
+	if (constructed == blocks.size() * CLIENTS_PER_BLOCK)
+		blocks.push_back(static_cast<Client *>(operator new(CLIENTS_PER_BLOCK * sizeof(Client))));
+	Client *client = new (&blocks[constructed / CLIENTS_PER_BLOCK][constructed % CLIENTS_PER_BLOCK]) Client(-1);
+	constructed++;
+	return client;
+}
+
+// Returns the client already stored under fd if there is one.
+Client *ClientTable::insert(int fd)
+{
+	if (fd < 0)
+		return NULL;
+	if (static_cast<size_t>(fd) >= slots.size())
+		slots.resize(fd + 1, NULL);
+	if (slots[fd] != NULL)
+		return slots[fd];
+
+	Client *client = allocate();
+	client->reset(fd);
+	slots[fd] = client;
+	count++;
+	return client;
+}
+
+// The client is cleared right away so it drops its share of any queued
+// output, but keeps its storage for the next connection.
+void ClientTable::erase(int fd)
+{
+	Client *client = find(fd);
+	if (client == NULL)
+		return;
+	client->reset(-1);
+	slots[fd] = NULL;
+	freeList.push_back(client);
+	count--;
+}
+
+Client *ClientTable::find(int fd) const
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= slots.size())
+		return NULL;
+	return slots[fd];
+}
+
+Client *ClientTable::find(int fd, unsigned long id) const
+{
+	Client *client = find(fd);
+	if (client == NULL || client->getId() != id)
+		return NULL;
+	return client;
+}
+
+size_t ClientTable::size() const
+{
+	return count;
+}
+
+// One past the highest fd a client may be stored under, for walking the table.
+int ClientTable::limit() const
+{
+	return static_cast<int>(slots.size());
+}
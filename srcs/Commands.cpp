@@ -1,20 +1,23 @@
 #include "Commands.hpp"
 #include "Parser.hpp"
+#include "IrcBot.hpp"
 #include <iostream>
-#include <sstream>
-#include <sys/socket.h>
+#include <cstdlib>
 #include <ctime>
 #include <limits>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
 
 const int Commands::BOT_FD = -1;
 
 static int ft_atoi(const std::string& str)
 {
-	if (str.size() > 11)
+	char *end = NULL;
+	long num = std::strtol(str.c_str(), &end, 10);
+	if (str.empty() || *end != '\0')
 		return -2;
-	std::stringstream ss(str);
-	long num;
-	ss >> num;
 	if (num < static_cast<long>(std::numeric_limits<int>::min()) || num > static_cast<long>(std::numeric_limits<int>::max()))
 		return -2;
 
@@ -23,895 +26,1080 @@ static int ft_atoi(const std::string& str)
 
 std::string ft_itoa(int num)
 {
-	std::stringstream ss;
-	ss << num;
-	return ss.str();
+	std::string out;
+	Reply::appendNumber(out, num);
+	return out;
 }
 
-Commands::Commands(std::map<int, Client>& c, std::map<std::string, Channel>& ch, Server& server)
-	: clients(c), channels(ch), server(server), botExists(false)
+// RFC 2812: a letter or one of []\`_^{|} first, then letters, digits, those
+// and '-'. That keeps out ',' and '#', which would make the nick look like a
+// target list or a channel, and the prefix characters @ + : ! *.
+static bool isValidNickname(const std::string& nick)
 {
-	initializeCommandHandlers();
+	static const char special[] = "[]\\`_^{|}";
+	for (size_t i = 0; i < nick.size(); ++i)
+	{
+		unsigned char c = nick[i];
+		if (std::isalpha(c) || (c != '\0' && std::strchr(special, c) != NULL))
+			continue;
+		if (i == 0 || !(std::isdigit(c) || c == '-'))
+			return false;
+	}
+	return !nick.empty();
+}
+
+Commands::Commands(ClientTable& c, channelMap& ch, NameTable& names, const serverConfig& config, Server& server)
+	: clients(c), channels(ch), names(names), server(server), metrics(server.getMetrics()), tracer(server.getTracer()), operName(config.operName), operPassword(config.operPassword), reply(line, config.serverName), deliveryRound(0), tracedFanout(0)
+{
+	line.reserve(Reply::LINE_LIMIT);
+	if (config.services)
+		services.add(new IrcBot(BOT_FD, config.botAdmins));
+	services.start(*this);
+}
+
+// Indexed by Metrics::command, which doubles as the dispatch slot.
+const Commands::CommandHandler Commands::handlers[Metrics::COMMAND_COUNT] =
+{
+	&Commands::handlePass,
+	&Commands::handleNickCommand,
+	&Commands::handleUserCommand,
+	&Commands::handleJoin,
+	&Commands::handlePartCommand,
+	&Commands::handlePrivmsg,
+	&Commands::handleModeCommand,
+	&Commands::handleTopicCommand,
+	&Commands::handleKickCommand,
+	&Commands::handleInviteCommand,
+	&Commands::handleNamesCommand,
+	&Commands::handleQuitCommand,
+	&Commands::handleStatsCommand,
+	&Commands::handleOperCommand,
+	NULL
+};
+
+// Resolves a command name without allocating: the length and first letter
+// narrow it to at most two candidates before a single comparison.
+Metrics::command Commands::findCommand(const lineView& cmd)
+{
+	switch (cmd.size)
+	{
+		case 4:
+			switch (cmd.data[0])
+			{
+				case 'J': return equals(cmd, "JOIN") ? Metrics::CMD_JOIN : Metrics::CMD_UNKNOWN;
+				case 'K': return equals(cmd, "KICK") ? Metrics::CMD_KICK : Metrics::CMD_UNKNOWN;
+				case 'M': return equals(cmd, "MODE") ? Metrics::CMD_MODE : Metrics::CMD_UNKNOWN;
+				case 'N': return equals(cmd, "NICK") ? Metrics::CMD_NICK : Metrics::CMD_UNKNOWN;
+				case 'O': return equals(cmd, "OPER") ? Metrics::CMD_OPER : Metrics::CMD_UNKNOWN;
+				case 'Q': return equals(cmd, "QUIT") ? Metrics::CMD_QUIT : Metrics::CMD_UNKNOWN;
+				case 'U': return equals(cmd, "USER") ? Metrics::CMD_USER : Metrics::CMD_UNKNOWN;
+				case 'P':
+					if (equals(cmd, "PASS"))
+						return Metrics::CMD_PASS;
+					return equals(cmd, "PART") ? Metrics::CMD_PART : Metrics::CMD_UNKNOWN;
+			}
+			return Metrics::CMD_UNKNOWN;
+		case 5:
+			switch (cmd.data[0])
+			{
+				case 'T': return equals(cmd, "TOPIC") ? Metrics::CMD_TOPIC : Metrics::CMD_UNKNOWN;
+				case 'N': return equals(cmd, "NAMES") ? Metrics::CMD_NAMES : Metrics::CMD_UNKNOWN;
+				case 'S': return equals(cmd, "STATS") ? Metrics::CMD_STATS : Metrics::CMD_UNKNOWN;
+			}
+			return Metrics::CMD_UNKNOWN;
+		case 6:
+			return equals(cmd, "INVITE") ? Metrics::CMD_INVITE : Metrics::CMD_UNKNOWN;
+		case 7:
+			return equals(cmd, "PRIVMSG") ? Metrics::CMD_PRIVMSG : Metrics::CMD_UNKNOWN;
+	}
+	return Metrics::CMD_UNKNOWN;
+}
+
+// Services hear about a command only once it has been fully handled. The
+// time recorded covers both.
+void Commands::executeCommand(const ircMessage& msg, size_t size, Client& client)
+{
+	Metrics::command slot = findCommand(msg.command);
+	unsigned long long start = Metrics::nowNs();
+	if (tracer.enabled())
+	{
+		tracedChannel.clear();
+		tracedFanout = 0;
+	}
+	runCommand(msg, slot, client);
+	services.dispatch(*this);
+	unsigned long long end = Metrics::nowNs();
+	metrics.observeCommand(slot, size, end - start);
+	if (tracer.enabled())
+		traceCommand(msg, slot, client, start, end);
 }
 
-void Commands::initializeCommandHandlers()
+// The trace names the channel a command reached, or else the channel it
+// was aimed at, and counts every copy it queued for channel members.
+void Commands::traceCommand(const ircMessage& msg, Metrics::command slot, const Client& client,
+	unsigned long long start, unsigned long long end)
 {
-	commandHandlers["PASS"] = &Commands::handlePass;
-	commandHandlers["JOIN"] = &Commands::handleJoin;
-	commandHandlers["PRIVMSG"] = &Commands::handlePrivmsg;
-	commandHandlers["USER"] = &Commands::handleUserCommand;
-	commandHandlers["NICK"] = &Commands::handleNickCommand;
-	commandHandlers["MODE"] = &Commands::handleModeCommand;
-	commandHandlers["PART"] = &Commands::handlePartCommand;
-	commandHandlers["QUIT"] = &Commands::handleQuitCommand;
-	commandHandlers["TOPIC"] = &Commands::handleTopicCommand;
-	commandHandlers["KICK"] = &Commands::handleKickCommand;
-	commandHandlers["INVITE"] = &Commands::handleInviteCommand;
+	if (tracedChannel.empty() && msg.paramCount > 0 && msg.params[0].size > 0 && msg.params[0].data[0] == '#')
+		tracedChannel.assign(msg.params[0].data, msg.params[0].size);
+	tracer.record(client.getShard(), Metrics::COMMAND_NAMES[slot], start, end, client.getFd(),
+		tracedChannel.data(), tracedChannel.size(), tracedFanout);
 }
 
-void Commands::executeCommand(const std::string& raw, Client& client)
+void Commands::noteFanout(const Channel& channel, size_t recipients)
 {
-	parseInfo info = Parser::parse(raw);
-	std::string cmd = info.command;
+	metrics.observeFanout(recipients);
+	if (tracer.enabled())
+	{
+		tracedChannel = channel.getName();
+		tracedFanout += recipients;
+	}
+}
+
+void Commands::runCommand(const ircMessage& msg, Metrics::command slot, Client& client)
+{
+	const lineView& cmd = msg.command;
 
-	if (cmd == "PASS")
+	if (slot == Metrics::CMD_PASS)
 	{
-		handlePass(raw, client);
+		handlePass(msg, client);
 		return;
 	}
 
 	if (!client.getIsAuth())
 	{
-		std::string err = "You have not registered yet\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOTREGISTERED, client.getNickname()).end());
 		return;
 	}
 
 	if (!client.isProvided())
 	{
-		if (cmd == "USER")
-			handleUserCommand(raw, client);
-		else if (cmd == "NICK")
-			handleNickCommand(raw, client);
+		if (slot == Metrics::CMD_USER)
+			handleUserCommand(msg, client);
+		else if (slot == Metrics::CMD_NICK)
+			handleNickCommand(msg, client);
 		else
 		{
-			std::string err = "Please provide your nickname and username by using /NICK <nickname> and /USER <'username' 0 * :'realname'>\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
+			reply.numeric(Reply::ERR_NOTREGISTERED, client.getNickname());
+			reply.trailing("Please provide your nickname and username by using /NICK <nickname> and /USER <username> 0 * :<realname>");
+			server.queueMessage(client.getFd(), reply.end());
 		}
 		return;
 	}
 
-	std::map<std::string, CommandHandler>::iterator it = commandHandlers.find(cmd);
-	if (it != commandHandlers.end())
-		(this->*(it->second))(raw, client);
+	CommandHandler handler = handlers[slot];
+	if (handler != NULL)
+		(this->*handler)(msg, client);
 	else
 	{
-		std::string err = ":server NOTICE " + client.getNickname() + " " + cmd + " :Unknown command\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_UNKNOWNCOMMAND, client.getNickname()).param(cmd.data, cmd.size).end());
 	}
 }
 
-void Commands::handlePass(const std::string& message, Client& client)
+void Commands::handlePass(const ircMessage& msg, Client& client)
 {
-	parseInfo info = Parser::parse(message);
-	
+
 	if (client.getIsAuth())
 	{
-		std::string err = "You may not reregister\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_ALREADYREGISTRED, client.getNickname()).end());
 		return;
 	}
 
-	if (info.function.empty())
+	if (msg.paramCount == 0 || msg.params[0].size == 0)
 	{
-		std::string err = "Not enough parameters for PASS. Use correct format: '/PASS <pwd>'\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("PASS").end());
 		return;
 	}
 
-	if (info.function != client.getPwd())
+	if (!equals(msg.params[0], client.getPwd()))
 	{
-		std::string err = "Password is incorrect\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_PASSWDMISMATCH, client.getNickname()).end());
 		return;
 	}
 
 	client.setIsAuth(true);
-	std::string success = "Welcome to the Concord. You are now registered.\r\n";
-	send(client.getFd(), success.c_str(), success.size(), 0);
+	server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing("Welcome to the Concord. You are now registered.").end());
 }
 
-void Commands::handleUserCommand(const std::string& msg, Client& client)
+void Commands::handleUserCommand(const ircMessage& msg, Client& client)
 {
-	userInfo info = Parser::userParse(msg);
-	if (info.userName.empty() || info.realName.empty())
+	if (msg.paramCount < 4 || msg.params[0].size == 0 || msg.params[3].size == 0)
 	{
-		std::string err = "Not enough parameters for USER. Use the correct format: '/USER <username> 0 * :<realname>'\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("USER").end());
 		return;
 	}
 
-	if (info.userName == "bot")
+	std::string userName = toString(msg.params[0]);
+	std::string realName = toString(msg.params[3]);
+
+	if (userName == "bot")
 	{
-		std::string err = "Username 'bot' is reserved for the server bot\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing("Username 'bot' is reserved for the server bot").end());
 		return;
 	}
 
-	std::string oldUsername = client.getUsername();
-	
-	client.setUsername(info.userName);
-	client.setRealname(info.realName);
-	std::string noticeMsg = "Your username is set to: " + info.userName + "\r\n";
-	send(client.getFd(), noticeMsg.c_str(), noticeMsg.size(), 0);
-	std::string noticeMsg2 = "Your realname is set to: " + info.realName + "\r\n";
-	send(client.getFd(), noticeMsg2.c_str(), noticeMsg2.size(), 0);
+	client.setUsername(userName);
+	client.setRealname(realName);
+	server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing("Your username is set to: ").append(userName).end());
+	server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing("Your realname is set to: ").append(realName).end());
 }
 
-void Commands::handleNickCommand(const std::string& nick, Client& client)
+void Commands::handleNickCommand(const ircMessage& msg, Client& client)
 {
-	parseInfo info = Parser::parse(nick);
-	std::string cmd = info.function;
+	std::string cmd = msg.paramCount > 0 ? toString(msg.params[0]) : "";
 
 	if (cmd.empty())
 	{
-		std::string err = "No nickname given. Use the correct format: '/NICK <nickname>'\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NONICKNAMEGIVEN, client.getNickname()).end());
 		return;
 	}
 
-	if (cmd == "IrcBot")
+	std::string oldNickname = client.getNickname();
+	if (cmd.size() > NICKLEN || !isValidNickname(cmd))
 	{
-		std::string err = "Nickname 'IrcBot' is reserved for the server bot\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_ERRONEUSNICKNAME, oldNickname).param(cmd).end());
 		return;
 	}
-	if (server.addNick(cmd) == false)
+
+	std::string oldPrefix = client.getPrefix();
+	if (server.setNick(client, cmd) == false)
 	{
-		std::string err = ":server 433 " + cmd + " :" + cmd + " is already in use\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NICKNAMEINUSE, oldNickname).param(cmd).end());
 		return;
 	}
-	if (client.getNickname().empty())
+	if (oldNickname.empty())
 	{
-		std::string noticeMsg = ":Server 001 " + cmd + "\r\n";
-		send(client.getFd(), noticeMsg.c_str(), noticeMsg.size(), 0);
-		client.setNickname(cmd);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_WELCOME, cmd).end());
 		return;
 	}
 
-	std::string oldNickname = client.getNickname();
-	std::string msg = ":" + oldNickname + " NICK :" + cmd + "\r\n";
-	send(client.getFd(), msg.c_str(), msg.size(), 0);
+	MessageBuffer nickMsg(reply.command(oldPrefix, "NICK").trailing(cmd).end());
+	server.queueMessage(client.getFd(), nickMsg);
+	services.publish(serviceEvent::NICK, client, NameTable::NONE, oldNickname);
 	
-	std::vector<std::string> channelsList = client.getJoinedChannels();
-	for (std::vector<std::string>::iterator it = channelsList.begin(); it != channelsList.end(); ++it)
-	{
-		std::string channelName = *it;
-		if (channels.find(channelName) != channels.end())
-		{
-			std::vector<Client>& users = channels[channelName].getUsers();
-			for (std::vector<Client>::iterator userIt = users.begin(); userIt != users.end(); ++userIt)
-			{
-				if (userIt->getFd() != client.getFd())
-				{
-					std::string msgToUser = ":" + oldNickname + " NICK :" + cmd + "\r\n";
-					send(userIt->getFd(), msgToUser.c_str(), msgToUser.size(), 0);
-				}
-			}
-			if (channels[channelName].isOp(oldNickname))
-			{
-				channels[channelName].removeOp(oldNickname);
-				channels[channelName].addOp(cmd);
-			}
-			channels[channelName].removeUser(client);
-		}
-	}
-	client.setNickname(cmd);
-	for (std::vector<std::string>::iterator it = channelsList.begin(); it != channelsList.end(); ++it)
+	// Channels refer to the client by fd, so apart from the announcement only
+	// their cached NAMES lists change. Everyone who shares a channel hears of
+	// it once.
+	beginDelivery();
+	markDelivered(client.getFd());
+	const std::vector<nameId>& channelsList = client.getJoinedChannels();
+	for (std::vector<nameId>::const_iterator it = channelsList.begin(); it != channelsList.end(); ++it)
 	{
-		std::string channelName = *it;
-		if (channels.find(channelName) != channels.end())
-			channels[channelName].addUser(client);
+		channelMap::iterator channel = channels.find(*it);
+		if (channel == channels.end())
+			continue;
+		channel->second.renameMember(client.getFd(), oldNickname, client.getNickname());
+		broadcastOnce(channel->second, nickMsg);
 	}
-	server.removeNick(oldNickname);
-	server.addNick(cmd);
 }
 
-bool Commands::isOP(const std::string& channelName, const Client& client)
+// Hands operator status to someone else once the last regular operator is
+// gone and announces it.
+void Commands::promoteOp(Channel& channel, int excludeFd)
+{
+	int promoted;
+	if (!channel.pickOp(excludeFd, promoted))
+		return;
+
+	Client *client = clients.find(promoted);
+	if (client == NULL)
+		return;
+	channel.setOp(promoted, true, client->getNickname());
+
+	broadcast(channel, reply.command("MODE").param(channel.getName()).param("+o").param(client->getNickname()).end());
+}
+
+void Commands::removeOp(Channel& channel, const Client& client)
+{
+	channel.setOp(client.getFd(), false, client.getNickname());
+	promoteOp(channel, client.getFd());
+}
+
+// Takes client out of the channel, passing operator status on if it had it.
+void Commands::removeMember(Channel& channel, const Client& client)
+{
+	if (channel.removeMember(client.getFd(), client.getNickname()) & channelMember::OP)
+		promoteOp(channel, client.getFd());
+}
+
+// Channels are keyed by the interned id of their name, so a lookup folds
+// and hashes the name once and everything after that compares ids.
+Channel *Commands::findChannel(const std::string& name)
+{
+	nameId id = names.find(name);
+	if (id == NameTable::NONE)
+		return NULL;
+
+	channelMap::iterator it = channels.find(id);
+	return it == channels.end() ? NULL : &it->second;
+}
+
+// Sizes the channel's NAMES chunks so a 353 line fits in LINE_LIMIT for any
+// recipient: ":<server> 353 <nick> = <channel> :<names>\r\n".
+Channel& Commands::createChannel(const std::string& name)
+{
+	size_t header = 1 + reply.getServerName().size() + 5 + NICKLEN + 3 + name.size() + 2;
+	nameId id = names.acquire(name);
+	Channel& channel = channels.insert(std::make_pair(id, Channel(name, id, Reply::LINE_LIMIT - 2 - header))).first->second;
+	metrics.setGauge(Metrics::CHANNELS, channels.size());
+	return channel;
+}
+
+void Commands::dropChannel(Channel& channel)
 {
-	std::map<std::string, Channel>::iterator it = channels.find(channelName);
-	if (it != channels.end())
+	nameId id = channel.getId();
+	const std::vector<channelMember>& members = channel.getMembers();
+	for (std::vector<channelMember>::const_iterator it = members.begin(); it != members.end(); ++it)
 	{
-		const std::vector<std::string>& ops = it->second.getOps();
-		return (std::find(ops.begin(), ops.end(), client.getNickname()) != ops.end());
+		Client *service = (it->flags & channelMember::SERVICE) ? services.findClient(it->fd) : NULL;
+		if (service != NULL)
+			service->partChannel(id);
 	}
+	channels.erase(id);
+	names.release(id);
+	metrics.setGauge(Metrics::CHANNELS, channels.size());
+}
+
+Client *Commands::memberClient(const channelMember& member)
+{
+	if (member.flags & channelMember::SERVICE)
+		return services.findClient(member.fd);
+	return clients.find(member.fd);
+}
 
-	return false;
+// Serializes the message once and queues the same buffer for every member.
+void Commands::broadcast(Channel& channel, const std::string& msg, int skipFd)
+{
+	broadcast(channel, MessageBuffer(msg), skipFd);
 }
 
-void Commands::handleJoin(const std::string& raw, Client& client)
+void Commands::broadcast(Channel& channel, const MessageBuffer& msg, int skipFd)
 {
-	parseInfo info = Parser::parse(raw);
-	std::string channelName = info.function;
+	const std::vector<channelMember>& members = channel.getMembers();
+	size_t recipients = 0;
+	for (std::vector<channelMember>::const_iterator it = members.begin(); it != members.end(); ++it)
+		if (it->fd != skipFd)
+		{
+			server.queueMessage(it->fd, msg);
+			recipients++;
+		}
+	noteFanout(channel, recipients);
+}
 
-	if (channelName.empty() || channelName[0] != '#')
+// Like broadcast, but skips every fd the current delivery round has already
+// reached, so someone sharing several channels with the source gets one copy.
+void Commands::broadcastOnce(Channel& channel, const MessageBuffer& msg)
+{
+	const std::vector<channelMember>& members = channel.getMembers();
+	size_t recipients = 0;
+	for (std::vector<channelMember>::const_iterator it = members.begin(); it != members.end(); ++it)
+		if (markDelivered(it->fd))
+		{
+			server.queueMessage(it->fd, msg);
+			recipients++;
+		}
+	noteFanout(channel, recipients);
+}
+
+bool Commands::isOP(const Channel& channel, const Client& client)
+{
+	return channel.isOp(client.getFd());
+}
+
+// "JOIN #a,#b key1,key2": every channel is joined in turn, keys paired with
+// channels by position. Replies only reach the send queues here and are
+// written out together once the read round is over.
+void Commands::handleJoin(const ircMessage& msg, Client& client)
+{
+	lineView none = { "", 0 };
+	const lineView& list = msg.paramCount > 0 ? msg.params[0] : none;
+	const lineView& keys = msg.paramCount > 1 ? msg.params[1] : none;
+	size_t pos = 0;
+	size_t keyPos = 0;
+	lineView name;
+	lineView key;
+
+	while (nextItem(list, pos, name))
 	{
-		std::string err = ":server 403 " + client.getNickname() + " " + channelName + " :No such channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		if (!nextItem(keys, keyPos, key))
+			key = none;
+		joinChannel(toString(name), key, client);
+	}
+}
+
+void Commands::joinChannel(std::string channelName, const lineView& key, Client& client)
+{
+	if (channelName.empty() || channelName[0] != '#' || channelName.size() > CHANNELLEN)
+	{
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOSUCHCHANNEL, client.getNickname()).param(channelName).end());
 		return;
 	}
 	
 	bool channelCreated = false;
-	if (channels.find(channelName) == channels.end())
-	{
-		channels[channelName] = Channel(channelName);
-		channels[channelName].setPwd("");
-		channels[channelName].setName(channelName);
-		channels[channelName].setInvOnly(false);
-		channels[channelName].setMaxUsers(-1);
-		channels[channelName].addOp(client.getNickname());
+	Channel *channel = findChannel(channelName);
+	if (channel == NULL)
+	{
+		channel = &createChannel(channelName);
 		channelCreated = true;
 	}
 	else
 	{
-		if (channels[channelName].getInvOnly())
+		channelName = channel->getName();
+		if (channel->hasMode(Channel::MODE_INVITE))
 		{
-			if (std::find(channels[channelName].getInvitedUsers().begin(), channels[channelName].getInvitedUsers().end(), client.getNickname()) == channels[channelName].getInvitedUsers().end())
+			if (!channel->isInvited(client.getId(), std::time(NULL)))
 			{
-				std::string err = ":server 473 " + client.getNickname() + " " + channelName + " :Cannot join channel (+i)\r\n";
-				send(client.getFd(), err.c_str(), err.size(), 0);
+				server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_INVITEONLYCHAN, client.getNickname()).param(channelName).end());
 				return;
 			}
 		}
-		if (channels[channelName].getPwd() != "")
+		if (channel->hasMode(Channel::MODE_KEY))
 		{
-			if (info.value.empty() || info.value != channels[channelName].getPwd())
+			if (!equals(key, channel->getKey()))
 			{
-				std::string err = ":server 475 " + client.getNickname() + " " + channelName + " :Cannot join channel (+k)\r\n";
-				send(client.getFd(), err.c_str(), err.size(), 0);
+				server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_BADCHANNELKEY, client.getNickname()).param(channelName).end());
 				return;
 			}
 		}
 
-		if (channels[channelName].getMaxUsers() != -1 && 
-			static_cast<int>(channels[channelName].getUsers().size()) >= channels[channelName].getMaxUsers())
+		if (channel->isFull())
 		{
-			std::string err = ":server 471 " + client.getNickname() + " " + channelName + " :Cannot join channel (+l)\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
+			server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_CHANNELISFULL, client.getNickname()).param(channelName).end());
 			return;
 		}
 
-		std::vector<Client>::iterator it;
-		std::vector<Client>& users = channels[channelName].getUsers();
-		
-		for (it = users.begin(); it != users.end(); ++it)
+		if (channel->hasMember(client.getFd()))
 		{
-			if (it->getFd() == client.getFd())
-			{
-				std::string err = ":server 443 " + client.getNickname() + " " + channelName + " :is already on channel\r\n";
-				send(client.getFd(), err.c_str(), err.size(), 0);
-				return;
-			}
+			server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_USERONCHANNEL, client.getNickname()).param(client.getNickname()).param(channelName).end());
+			return;
 		}
 	}
 
-	channels[channelName].addUser(client);
-	client.joinChannel(channelName);
-
-	std::string joinMsg = ":" + client.getNickname() + "!" + client.getUsername() + "@" + client.getHostname() + " JOIN :" + channelName + "\r\n";
-	for (std::vector<Client>::iterator it = channels[channelName].getUsers().begin(); it != channels[channelName].getUsers().end(); ++it)
-		send(it->getFd(), joinMsg.c_str(), joinMsg.length(), 0);
+	channel->addMember(client.getFd(), channelCreated ? channelMember::OP : 0, client.getNickname());
+	client.joinChannel(channel->getId());
 
-	std::string topicMsg = ":server 332 " + client.getNickname() + " " + channelName + " :" + channels[channelName].getTopic() + "\r\n";
-	send(client.getFd(), topicMsg.c_str(), topicMsg.length(), 0);
+	broadcast(*channel, reply.command(client.getPrefix(), "JOIN").trailing(channelName).end());
+	server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_TOPIC, client.getNickname()).param(channelName).trailing(channel->getTopic()).end());
 
-	std::string names;
+	sendNames(*channel, client);
 
-	std::vector<Client> &users = channels[channelName].getUsers();
-	for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
-	{
-		if (channels[channelName].isOp(it->getNickname()))
-			names += "@" + it->getNickname() + " ";
-		else
-			names += it->getNickname() + " ";
-	}
-
-	std::string namesMsg = ":server 353 " + client.getNickname() + " = " + channelName + " :" + names + "\r\n";
-	send(client.getFd(), namesMsg.c_str(), namesMsg.length(), 0);
-
-	std::string endNames = ":server 366 " + client.getNickname() + " " + channelName + " :End of /NAMES list.\r\n";
-	send(client.getFd(), endNames.c_str(), endNames.length(), 0);
-	
 	if (channelCreated)
-	{
-		std::string modeMsg = ":" + client.getNickname() + " MODE " + channelName + " +o " + client.getNickname() + "\r\n";
-		std::vector<Client>& users = channels[channelName].getUsers();
-		for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
-			send(it->getFd(), modeMsg.c_str(), modeMsg.length(), 0);
-		botJoinChannel(channelName);
-	}
-	else
-		botJoinChannel(channelName);
+		broadcast(*channel, reply.command(client.getNickname(), "MODE").param(channelName).param("+o").param(client.getNickname()).end());
 
-	botGreetUser(channelName, client.getNickname());
-	botGiveOpToUser(channelName, client.getNickname());
-	std::vector<std::string>& invited = channels[channelName].getInvitedUsers();
-	std::vector<std::string>::iterator toDel = std::find(invited.begin(), invited.end(), client.getNickname());
-	if (toDel != invited.end())
-		invited.erase(toDel);
+	channel->removeInvite(client.getId());
+	services.publish(serviceEvent::JOIN, client, channel->getId());
 }
 
-void Commands::handlePartCommand(const std::string& msg, Client& client)
+void Commands::handlePartCommand(const ircMessage& msg, Client& client)
 {
-	std::vector<std::string> words = split(msg);
-	if (words.size() < 2)
+	if (msg.paramCount < 1)
 	{
-		std::string err = ":server 461 " + client.getNickname() + " :Not enough parameters\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("PART").end());
 		return;
 	}
 
-	std::string channelName = words[1];
-	if (channels.find(channelName) == channels.end())
+	size_t pos = 0;
+	lineView name;
+	while (nextItem(msg.params[0], pos, name))
+		partChannel(toString(name), client);
+}
+
+void Commands::partChannel(const std::string& channelName, Client& client)
+{
+	Channel *channel = findChannel(channelName);
+	if (channel == NULL)
 	{
-		std::string err = ":server 403 " + client.getNickname() + " " + channelName + " :No such channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOSUCHCHANNEL, client.getNickname()).param(channelName).end());
 		return;
 	}
 
-	std::string noticeMsg = ":" + client.getNickname() + "!" + client.getUsername() + "@" + client.getHostname() + " PART " + channelName + "\r\n";
-	for (std::vector<Client>::iterator it = channels[channelName].getUsers().begin(); it != channels[channelName].getUsers().end(); ++it)
-		send(it->getFd(), noticeMsg.c_str(), noticeMsg.size(), 0);
-	channels[channelName].removeUser(client);
-	channels[channelName].removeOp(client.getNickname());
-	client.partChannel(channelName);
-	if (channels[channelName].getUsers().size() == 1)
-		channels.erase(channelName);
+	broadcast(*channel, reply.command(client.getPrefix(), "PART").param(channel->getName()).end());
+	removeMember(*channel, client);
+	client.partChannel(channel->getId());
+	services.publish(serviceEvent::PART, client, channel->getId());
+	if (!channel->hasUsers())
+		dropChannel(*channel);
 }
 
-void Commands::handleTopicCommand(const std::string& msg, Client& client)
+void Commands::handleTopicCommand(const ircMessage& msg, Client& client)
 {
-	std::vector<std::string> words = split(msg);
-	if (words.size() < 2)
+	if (msg.paramCount < 1)
 	{
-		std::string err = ":server 461 " + client.getNickname() + " " + words[0] + " :Not enough parameters\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("TOPIC").end());
 		return;
 	}
-	std::string channelName = words[1];
-	if (channels.find(channelName) == channels.end())
+	std::string channelName = toString(msg.params[0]);
+	Channel *channel = findChannel(channelName);
+	if (channel == NULL)
 	{
-		std::string err = ":server 403 " + client.getNickname() + " " + channelName + " :No such channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOSUCHCHANNEL, client.getNickname()).param(channelName).end());
 		return;
 	}
-	if (words.size() != 2 && !isOP(channelName, client) && !channels[channelName].getTopicSet())
+	channelName = channel->getName();
+	if (msg.paramCount > 1 && !isOP(*channel, client) && channel->hasMode(Channel::MODE_TOPIC))
 	{
-		std::string err = ":server 482 " + client.getNickname() + " " + channelName + " :You're not channel operator\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_CHANOPRIVSNEEDED, client.getNickname()).param(channelName).end());
 		return;
 	}
-	if (words.size() == 2)
+	if (msg.paramCount == 1)
 	{
-		std::string topic = channels[channelName].getTopic();
-		std::string topicMsg = ":server 332 " + client.getNickname() + " " + channelName + " :" + topic + "\r\n";
-		send(client.getFd(), topicMsg.c_str(), topicMsg.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_TOPIC, client.getNickname()).param(channelName).trailing(channel->getTopic()).end());
 		return;
 	}
 	else
-	{
-		std::string topicHandled;
-		if (words[2][0] != ':')
-		{
-			std::string err = ":server 461 " + client.getNickname() + " " + words[0] + " :Not enough parameters\r\n";
-			send(client.getFd(), err.c_str(), err.size(), 0);
-			return;
-		}
-		words[2].erase(0, 1);
-		for(size_t i = 2; i < words.size(); ++i)
-		{
-			if (i > 2)
-				topicHandled += " ";
-			topicHandled += words[i];
-		}
-		channels[channelName].setTopic(topicHandled);
-	}
+		channel->setTopic(toString(msg.params[1]));
 
-	std::string topic = channels[channelName].getTopic();
-	std::string topicSetBy = client.getNickname();
-	std::time_t topicSetAt = std::time(NULL);
-
-	std::string topicMsg = ":server 332 " + client.getNickname() + " " + channelName + " :" + topic + "\r\n";
-	std::string topicSetMsg = ":server 333 " + client.getNickname() + " " + channelName + " " + topicSetBy + " " + ft_itoa(topicSetAt) + "\r\n";
+	std::string topicMsg = reply.numeric(Reply::RPL_TOPIC, client.getNickname()).param(channelName).trailing(channel->getTopic()).end();
+	topicMsg += reply.numeric(Reply::RPL_TOPICWHOTIME, client.getNickname()).param(channelName).param(client.getNickname()).param(std::time(NULL)).end();
+	broadcast(*channel, topicMsg);
+}
 
-	std::vector<Client>& users = channels[channelName].getUsers();
-	for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
+void Commands::handleModeCommand(const ircMessage& msg, Client& client)
+{
+	std::string channelName = msg.paramCount > 0 ? toString(msg.params[0]) : "";
+	bool status = false;
+	std::string key;
+	std::string parameters = msg.paramCount > 2 ? toString(msg.params[2]) : "";
+	if (msg.paramCount > 1)
 	{
-		send(it->getFd(), topicMsg.c_str(), topicMsg.size(), 0);
-		send(it->getFd(), topicSetMsg.c_str(), topicSetMsg.size(), 0);
+		const lineView& modes = msg.params[1];
+		size_t letter = (modes.size > 0 && (modes.data[0] == '+' || modes.data[0] == '-')) ? 1 : 0;
+		status = modes.size > 0 && modes.data[0] == '+';
+		if (letter < modes.size)
+			key.assign(1, modes.data[letter]);
 	}
-}
 
-void Commands::handleModeCommand(const std::string& msg, Client& client)
-{
-	modeInfo info = Parser::modeParse(msg);
-	if (info.channel.empty())
+	if (channelName.empty())
 	{
-		std::string err = ":server 461 " + client.getNickname() + " MODE :Not enough parameters\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("MODE").end());
 		return;
 	}
-	if (info.channel[0] != '#')
+	Channel *channel = channelName[0] == '#' ? findChannel(channelName) : NULL;
+	if (channel == NULL)
 	{
-		std::string err = ":server 403 " + client.getNickname() + " " + info.channel + " :No such channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOSUCHCHANNEL, client.getNickname()).param(channelName).end());
 		return;
 	}
-	if (info.key.empty())
+	channelName = channel->getName();
+	if (msg.paramCount < 2)
 	{
-		std::string modes = "";
-		if (channels[info.channel].getInvOnly())
-			modes += "i";
-		if (!channels[info.channel].getPwd().empty())
-			modes += "k";
-		if (channels[info.channel].getMaxUsers() != -1)
-			modes += "l";
-		if (!channels[info.channel].getTopicSet())
-			modes += "t";
-		if (modes.empty())
-		{
-			modes = ":" + client.getNickname() + " NOTICE " + client.getNickname() + " Current modes in " + info.channel + " are: None" + "\r\n";
-			send(client.getFd(), modes.c_str(), modes.size(), 0);
-			return;
-		}
-		std::string noticeMsg = ":" + client.getNickname() + " NOTICE " + client.getNickname() + " Current modes in " + info.channel + " are: +" + modes;
-		noticeMsg += "\r\n";
-		send(client.getFd(), noticeMsg.c_str(), noticeMsg.size(), 0);
+		reply.numeric(Reply::RPL_CHANNELMODEIS, client.getNickname()).param(channelName).param("+").append(channel->getModeString());
+		server.queueMessage(client.getFd(), reply.end());
 		return;
 	}
 
-	if (isOP(channels[info.channel].getName(), client) == false)
+	if (isOP(*channel, client) == false)
 	{
-		std::string err = ":server 482 " + client.getNickname() + " " + channels[info.channel].getName() + " :Permission Denied - You're not an operator in this server.\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_CHANOPRIVSNEEDED, client.getNickname()).param(channelName).end());
 		return;
 	}
 
-	std::vector<std::string> &ops = channels[info.channel].getOps();
-	std::vector<std::string>::iterator it = ops.begin();
-	std::vector<std::string>::iterator ite = ops.end();
-	std::string noticeMsg;
-	while (it != ite)
+	std::string argument;
+	if (key == "i")
+		channel->setMode(Channel::MODE_INVITE, status);
+	else if (key == "k")
 	{
-		if (*it == client.getNickname())
+		if (status == false)
+			channel->setKey("");
+		else if (parameters.empty())
 		{
-			if (info.key == "i")
-			{
-				if (!channels[info.channel].getInvOnly())
-					channels[info.channel].setInvOnly(info.status);
-				else
-					channels[info.channel].setInvOnly(0);
-				noticeMsg = ":" + client.getNickname() + " MODE " + info.channel + " " + (info.status ? "+i" : "-i") + "\r\n";
-			}
-			else if (info.key == "k")
-			{
-				if (info.status == false)
-					channels[info.channel].setPwd("");
-				else if (info.parameters.empty())
-				{
-					std::string err = ":server 461 " + client.getNickname() + " " + info.channel + " :Not enough parameters\r\n";
-					send(client.getFd(), err.c_str(), err.size(), 0);
-					return;
-				}
-				else
-					channels[info.channel].setPwd(info.parameters);
-				noticeMsg = ":" + client.getNickname() + " MODE " + info.channel + " " + (info.status ? "+k" : "-k") + " " + info.parameters + "\r\n";
-			}
-			else if (info.key == "l")
-			{
-				int maxUsers = -1;
-				if (!info.status)
-					channels[info.channel].setMaxUsers(maxUsers);
-				else if (info.parameters.empty())
-				{
-					std::string err = ":server 461 " + client.getNickname() + " " + info.channel + " :Not enough parameters\r\n";
-					send(client.getFd(), err.c_str(), err.size(), 0);
-					return;
-				}
-				else
-				{
-					maxUsers = ft_atoi(info.parameters);
-					if (maxUsers < 0)
-					{
-						std::string err = ":server 501 " + client.getNickname() + " " + info.channel + " :Invalid parameter\r\n";
-						send(client.getFd(), err.c_str(), err.size(), 0);
-						return;
-					}
-					channels[info.channel].setMaxUsers(maxUsers);
-				}
-				noticeMsg = ":" + client.getNickname() + " MODE " + info.channel + " " + (info.status ? "+l" : "-l") + " " + (maxUsers == -1 ? "" : ft_itoa(maxUsers)) + "\r\n";
-			}
-			else if (info.key == "o")
+			server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("MODE").end());
+			return;
+		}
+		else
+			channel->setKey(parameters);
+		argument = parameters;
+	}
+	else if (key == "l")
+	{
+		if (!status)
+			channel->setMode(Channel::MODE_LIMIT, false);
+		else if (parameters.empty())
+		{
+			server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("MODE").end());
+			return;
+		}
+		else
+		{
+			int maxUsers = ft_atoi(parameters);
+			if (maxUsers < 0)
 			{
-				if (channels[info.channel].isUserInChannel(info.parameters) == false)
-				{
-					std::string err = ":" + client.getNickname() +" NOTICE " + client.getNickname() + " :No such user in the Channel\r\n";
-					send(client.getFd(), err.c_str(), err.size(), 0);
-					return;
-				}
-
-				if (!info.status && info.parameters == "IrcBot")
-				{
-					std::string err = ":" + client.getNickname() +" NOTICE " + client.getNickname() + " :IrcBot cannot be deop'd\r\n";
-					send(client.getFd(), err.c_str(), err.size(), 0);
-					return;
-				}
-
-				if (info.status)
-				{
-					if (std::find(channels[info.channel].getOps().begin(), channels[info.channel].getOps().end(), info.parameters) == channels[info.channel].getOps().end())
-						channels[info.channel].addOp(info.parameters);
-					else
-					{
-						std::string err = ":" + client.getNickname() +" NOTICE " + client.getNickname() + " :The user is already OP!\r\n";
-						send(client.getFd(), err.c_str(), err.size(), 0);
-						return;
-					}
-				}
-				else
-				{
-					if (std::find(channels[info.channel].getOps().begin(), channels[info.channel].getOps().end(), info.parameters) != channels[info.channel].getOps().end())
-						channels[info.channel].removeOp(info.parameters);
-					else
-					{
-						std::string err = ":" + client.getNickname() +" NOTICE " + client.getNickname() + " :The user is not OP!\r\n";
-						send(client.getFd(), err.c_str(), err.size(), 0);
-						return;
-					}
-				}
-
-				noticeMsg = ":" + client.getNickname() + " MODE " + info.channel + " " + (info.status ? "+o" : "-o") + " " + info.parameters + "\r\n";
+				reply.numeric(Reply::ERR_INVALIDMODEPARAM, client.getNickname()).param(channelName).param("l").param(parameters);
+				server.queueMessage(client.getFd(), reply.end());
+				return;
 			}
-			else if (info.key == "t")
-			{
-				if (info.status)
-					channels[info.channel].setTopicSet(false);
-				else
-					channels[info.channel].setTopicSet(true);
+			channel->setLimit(maxUsers);
+			argument = ft_itoa(maxUsers);
+		}
+	}
+	else if (key == "o")
+	{
+		Client *target = server.findClient(parameters);
+		if (target == NULL || channel->hasMember(target->getFd()) == false)
+		{
+			server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_USERNOTINCHANNEL, client.getNickname()).param(parameters).param(channelName).end());
+			return;
+		}
 
-				noticeMsg = ":" + client.getNickname() + " MODE " + info.channel + " " + (info.status ? "+t" : "-t") + "\r\n";
+		if (!status && channel->isService(target->getFd()))
+		{
+			server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing(target->getNickname()).append(" cannot be deop'd").end());
+			return;
+		}
+
+		if (status)
+		{
+			if (!channel->isOp(target->getFd()))
+				channel->setOp(target->getFd(), true, target->getNickname());
+			else
+			{
+				server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing("The user is already OP!").end());
+				return;
 			}
+		}
+		else
+		{
+			if (channel->isOp(target->getFd()))
+				removeOp(*channel, *target);
 			else
 			{
-				std::string err = ":" + client.getNickname() + " NOTICE " + client.getNickname() + " " + info.key + " :is unknown mode char\r\n";
-				send(client.getFd(), err.c_str(), err.size(), 0);
+				server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing("The user is not OP!").end());
 				return;
 			}
-
-			for (std::vector<Client>::iterator user = channels[info.channel].getUsers().begin(); user != channels[info.channel].getUsers().end(); ++user)
-				send(user->getFd(), noticeMsg.c_str(), noticeMsg.size(), 0);
-
-			return;
 		}
-		++it;
+		argument = parameters;
+	}
+	else if (key == "t")
+		channel->setMode(Channel::MODE_TOPIC, status);
+	else
+	{
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_UNKNOWNMODE, client.getNickname()).param(key).end());
+		return;
 	}
 
-	std::string err = "482 " + client.getNickname() + " " + info.channel + " :You're not channel operator\r\n";
-	send(client.getFd(), err.c_str(), err.size(), 0);
+	// Built last: removeOp may already have used the reply buffer.
+	reply.command(client.getNickname(), "MODE").param(channelName).append(' ').append(status ? '+' : '-').append(key);
+	if (!argument.empty())
+		reply.param(argument);
+	broadcast(*channel, reply.end());
 }
 
-void Commands::handlePrivmsg(const std::string& message, Client& sender)
+// "PRIVMSG #a,nick :text": each target gets a line naming it, but a client
+// reached through an earlier target of the same command is skipped, so
+// someone on both #a and #b sees the message once.
+void Commands::handlePrivmsg(const ircMessage& msg, Client& sender)
 {
-	reciveMessage info = Parser::privateMessage(message);
-	if (info.target.empty() || info.message.empty())
+	if (msg.paramCount < 2 || msg.params[0].size == 0 || msg.params[1].size == 0)
 	{
-		std::string err = "411 " + sender.getNickname() + " :No recipient given\r\n";
-		send(sender.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(sender.getFd(), reply.numeric(Reply::ERR_NORECIPIENT, sender.getNickname()).end());
 		return;
 	}
 
-	if (info.target[0] != '#')
+	beginDelivery();
+	size_t pos = 0;
+	lineView target;
+	while (nextItem(msg.params[0], pos, target))
+		if (target.size != 0)
+			privmsgTarget(toString(target), msg.params[1], sender);
+}
+
+void Commands::privmsgTarget(const std::string& target, const lineView& text, Client& sender)
+{
+	if (target[0] != '#')
 	{
-		for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it)
+		Client *recipient = server.findClient(target);
+		if (recipient != NULL)
 		{
-			if (it->second.getNickname() == info.target)
+			if (markDelivered(recipient->getFd()))
 			{
-				std::string msg = ":" + sender.getNickname() + " PRIVMSG " + info.target + " :" + info.message + "\r\n";
-				send(it->first, msg.c_str(), msg.size(), 0);
-				return;
+				reply.command(sender.getPrefix(), "PRIVMSG").param(target).trailing(text.data, text.size);
+				server.queueMessage(recipient->getFd(), reply.end());
 			}
+			return;
 		}
 	}
 
-	std::map<std::string, Channel>::iterator it = channels.find(info.target);
-	if (it != channels.end() && it->second.isUserInChannel(sender.getNickname()))
+	Channel *channel = findChannel(target);
+	if (channel != NULL && channel->hasMember(sender.getFd()))
 	{
-		std::vector<Client>& users = it->second.getUsers();
-		std::string msg = ":" + sender.getNickname() + "!" + sender.getUsername() + "@" + sender.getHostname() + " PRIVMSG " + info.target + " :" + info.message + "\r\n";
-		for (std::vector<Client>::iterator user = users.begin(); user != users.end(); ++user)
-			if (user->getFd() != sender.getFd())
-				send(user->getFd(), msg.c_str(), msg.size(), 0);
+		reply.command(sender.getPrefix(), "PRIVMSG").param(target).trailing(text.data, text.size);
+		MessageBuffer buffer(reply.end());
+		const std::vector<channelMember>& members = channel->getMembers();
+		size_t recipients = 0;
+		for (std::vector<channelMember>::const_iterator it = members.begin(); it != members.end(); ++it)
+			if (it->fd != sender.getFd() && markDelivered(it->fd))
+			{
+				server.queueMessage(it->fd, buffer);
+				recipients++;
+			}
+		noteFanout(*channel, recipients);
+		if (services.wants(serviceEvent::MESSAGE))
+			services.publish(serviceEvent::MESSAGE, sender, channel->getId(), toString(text));
 		return;
 	}
 
-	std::string err = "401 " + sender.getNickname() + " " + info.target + " :No such nick/channel\r\n";
-	send(sender.getFd(), err.c_str(), err.size(), 0);
+	server.queueMessage(sender.getFd(), reply.numeric(Reply::ERR_NOSUCHNICK, sender.getNickname()).param(target).end());
 }
 
-void Commands::handleKickCommand(const std::string& msg, Client& client)
+// Delivery rounds stamp each fd they reach; bumping the round forgets every
+// stamp at once, and the table is only cleared when the counter wraps.
+void Commands::beginDelivery()
 {
-	std::vector<std::string> words = split(msg);
-	if (words.size() < 3)
+	if (++deliveryRound == 0)
 	{
-		std::string err = "461 " + client.getNickname() + " :Not enough parameters\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		std::fill(delivered.begin(), delivered.end(), 0);
+		deliveryRound = 1;
+	}
+}
+
+bool Commands::markDelivered(int fd)
+{
+	if (fd < 0)
+		return false;
+	if (static_cast<size_t>(fd) >= delivered.size())
+		delivered.resize(fd + 1, 0);
+	if (delivered[fd] == deliveryRound)
+		return false;
+	delivered[fd] = deliveryRound;
+	return true;
+}
+
+void Commands::handleKickCommand(const ircMessage& msg, Client& client)
+{
+	if (msg.paramCount < 2)
+	{
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("KICK").end());
 		return;
 	}
 
-	std::string channelName = words[1];
-	std::string targetNick = words[2];
-	if (channels.find(channelName) == channels.end())
+	std::string channelName = toString(msg.params[0]);
+	std::string targetNick = toString(msg.params[1]);
+	Channel *channel = findChannel(channelName);
+	if (channel == NULL)
 	{
-		std::string err = "403 " + client.getNickname() + " " + channelName + " :No such channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOSUCHCHANNEL, client.getNickname()).param(channelName).end());
 		return;
 	}
+	channelName = channel->getName();
 
-	std::vector<Client>& users = channels[channelName].getUsers();
-	bool isKickerInChannel = false;
+	if (!channel->hasMember(client.getFd()))
+	{
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOTONCHANNEL, client.getNickname()).param(channelName).end());
+		return;
+	}
 
-	for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
+	if (NameTable::equal(client.getNickname(), targetNick))
 	{
-		if (it->getNickname() == client.getNickname())
-		{
-			isKickerInChannel = true;
-			break;
-		}
+		server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing("Can't kick yourself").end());
+		return;
 	}
 
-	if (!isKickerInChannel)
+	if (!isOP(*channel, client))
 	{
-		std::string err = "442 " + channelName + " :You're not on that channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_CHANOPRIVSNEEDED, client.getNickname()).param(channelName).end());
 		return;
 	}
 
-	if (client.getNickname() == targetNick)
+	Client *target = server.findClient(targetNick);
+	if (target != NULL && channel->isService(target->getFd()))
 	{
-		std::string err = ":" + client.getNickname() + " NOTICE " + client.getNickname() + " :Can't kick yourself\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.notice(client.getNickname()).trailing(target->getNickname()).append(" cannot be kicked").end());
 		return;
 	}
+	if (target != NULL && channel->hasMember(target->getFd()))
+	{
+		broadcast(*channel, reply.command(client.getPrefix(), "KICK").param(channelName).param(targetNick).end());
+
+		target->partChannel(channel->getId());
+		removeMember(*channel, *target);
+		return;
+	}
+	server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_USERNOTINCHANNEL, client.getNickname()).param(targetNick).param(channelName).end());
+}
 
-	if (!isOP(channelName, client))
+void Commands::handleInviteCommand(const ircMessage& msg, Client& client)
+{
+	if (msg.paramCount < 2)
 	{
-		std::string err = "482 " + client.getNickname() + " " + channelName + " :You're not channel operator\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("INVITE").end());
 		return;
 	}
 
-	if (targetNick == "IrcBot")
+	std::string targetNick = toString(msg.params[0]);
+	std::string channelName = toString(msg.params[1]);
+	Channel *channel = findChannel(channelName);
+	if (channel == NULL)
 	{
-		std::string err = ":" + client.getNickname() + " NOTICE " + client.getNickname() + " :IrcBot cannot be kicked\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOSUCHCHANNEL, client.getNickname()).param(channelName).end());
 		return;
 	}
+	channelName = channel->getName();
 
-	for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
+	if (!isOP(*channel, client))
 	{
-		if (it->getNickname() == targetNick)
-		{
-			std::string noticeMsg = ":" + client.getNickname() + "!" + client.getUsername() + "@" + client.getHostname() + " KICK " + channelName + " " + targetNick + "\r\n";
-			for (std::vector<Client>::iterator it = channels[channelName].getUsers().begin(); it != channels[channelName].getUsers().end(); ++it)
-				send(it->getFd(), noticeMsg.c_str(), noticeMsg.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_CHANOPRIVSNEEDED, client.getNickname()).param(channelName).end());
+		return;
+	}
 
-			for (std::map<int, Client>::iterator clientIt = clients.begin(); clientIt != clients.end(); ++clientIt)
-			{
-				if (clientIt->second.getNickname() == targetNick)
-				{
-					clientIt->second.partChannel(channelName);
-					break;
-				}
-			}
-			
-			channels[channelName].removeUser(*it);
-			channels[channelName].removeOp(targetNick);
-			return;
-		}
+	Client *target = server.findClient(targetNick);
+	if (target == NULL)
+	{
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOSUCHNICK, client.getNickname()).param(targetNick).end());
+		return;
 	}
-	std::string err = ":" + client.getNickname() + " NOTICE " + client.getNickname() + " " + targetNick + " is not in that channel\r\n";
-	send(client.getFd(), err.c_str(), err.size(), 0);
+
+	channel->addInvite(target->getId(), std::time(NULL));
+	server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_INVITING, client.getNickname()).param(channelName).param(target->getNickname()).end());
+	server.queueMessage(target->getFd(), reply.command(client.getPrefix(), "INVITE").param(target->getNickname()).trailing(channelName).end());
 }
 
-void Commands::handleInviteCommand(const std::string& msg, Client& client)
+// "NAMES #a,#b": every channel of the list is answered in turn, an unknown
+// one with just its end marker. Without a list only the end marker for "*"
+// is sent.
+void Commands::handleNamesCommand(const ircMessage& msg, Client& client)
 {
-	std::vector<std::string> words = split(msg);
-	if (words.size() < 3)
+	if (msg.paramCount == 0)
 	{
-		std::string err = "461 " + client.getNickname() + " :Not enough parameters\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_ENDOFNAMES, client.getNickname()).param("*").end());
 		return;
 	}
 
-	std::string targetNick = words[1];
-	std::string channelName = words[2];
-	if (channels.find(channelName) == channels.end())
+	size_t pos = 0;
+	lineView name;
+	while (nextItem(msg.params[0], pos, name))
 	{
-		std::string err = "403 " + client.getNickname() + " " + channelName + " :No such channel\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
-		return;
+		if (name.size == 0)
+			continue;
+		std::string channelName = toString(name);
+		Channel *channel = findChannel(channelName);
+		if (channel == NULL)
+			server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_ENDOFNAMES, client.getNickname()).param(channelName).end());
+		else
+			sendNames(*channel, client);
 	}
+}
 
-	if (!isOP(channelName, client))
+// "STATS <query>": m lists each command with its count and bytes, u the
+// uptime, z the remaining counters with latency percentiles, and t writes
+// the trace file. t starts a disk write, so it is kept to operators; the
+// rest are open to any registered client.
+void Commands::handleStatsCommand(const ircMessage& msg, Client& client)
+{
+	if (msg.paramCount == 0 || msg.params[0].size == 0)
 	{
-		std::string err = "482 " + client.getNickname() + " " + channelName + " :You're not channel operator\r\n";
-		send(client.getFd(), err.c_str(), err.size(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("STATS").end());
 		return;
 	}
 
-	channels[channelName].addinvitedUser(targetNick);
-	std::string inviteMsg = ":" + client.getNickname() + " INVITE " + targetNick + " :" + channelName + "\r\n";
-	send(client.getFd(), inviteMsg.c_str(), inviteMsg.size(), 0);
-	std::string noticeMsg = ":server NOTICE " + targetNick + " :You have been invited to join " + channelName + "\r\n";
+	char query = msg.params[0].data[0];
+	char text[128];
+	Metrics::histogram h;
 
-	for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it)
+	if (query == 'm')
 	{
-		if (it->second.getNickname() == targetNick)
+		for (int c = 0; c < Metrics::COMMAND_COUNT; c++)
 		{
-			send(it->first, noticeMsg.c_str(), noticeMsg.size(), 0);
-			return;
+			Metrics::command cmd = static_cast<Metrics::command>(c);
+			if (metrics.getCommandCount(cmd) == 0)
+				continue;
+			reply.numeric(Reply::RPL_STATSCOMMANDS, client.getNickname()).param(Metrics::COMMAND_NAMES[c]);
+			reply.param(static_cast<long>(metrics.getCommandCount(cmd))).param(static_cast<long>(metrics.getCommandBytes(cmd))).param(0L);
+			server.queueMessage(client.getFd(), reply.end());
+		}
+	}
+	else if (query == 'u')
+	{
+		long up = std::time(NULL) - metrics.getStarted();
+		std::snprintf(text, sizeof(text), "Server Up %ld days %ld:%02ld:%02ld", up / 86400, up / 3600 % 24, up / 60 % 60, up % 60);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_STATSUPTIME, client.getNickname()).trailing(text).end());
+	}
+	else if (query == 'z')
+	{
+		static const struct
+		{
+			Metrics::counter	id;
+			const char			*name;
+		} counters[] =
+		{
+			{ Metrics::BYTES_READ, "bytes_read" },
+			{ Metrics::BYTES_WRITTEN, "bytes_written" },
+			{ Metrics::LINES_PARSED, "lines_parsed" },
+			{ Metrics::FANOUT_MESSAGES, "fanout_messages" },
+			{ Metrics::FANOUT_RECIPIENTS, "fanout_recipients" },
+			{ Metrics::LOOP_ITERATIONS, "loop_iterations" }
+		};
+		for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+		{
+			std::snprintf(text, sizeof(text), "%s %llu", counters[i].name, metrics.get(counters[i].id));
+			server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_STATSDEBUG, client.getNickname()).trailing(text).end());
+		}
+		std::snprintf(text, sizeof(text), "clients %llu channels %llu", metrics.get(Metrics::CLIENTS), metrics.get(Metrics::CHANNELS));
+		server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_STATSDEBUG, client.getNickname()).trailing(text).end());
+
+		metrics.getLoopTime(h);
+		std::snprintf(text, sizeof(text), "loop_ns p50 %llu p99 %llu", Metrics::percentile(h, 0.5), Metrics::percentile(h, 0.99));
+		server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_STATSDEBUG, client.getNickname()).trailing(text).end());
+		metrics.getFanout(h);
+		std::snprintf(text, sizeof(text), "fanout p50 %llu p99 %llu", Metrics::percentile(h, 0.5), Metrics::percentile(h, 0.99));
+		server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_STATSDEBUG, client.getNickname()).trailing(text).end());
+		for (int c = 0; c < Metrics::COMMAND_COUNT; c++)
+		{
+			metrics.getCommandTime(static_cast<Metrics::command>(c), h);
+			if (h.count == 0)
+				continue;
+			std::snprintf(text, sizeof(text), "%s_ns p50 %llu p99 %llu", Metrics::COMMAND_NAMES[c], Metrics::percentile(h, 0.5), Metrics::percentile(h, 0.99));
+			server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_STATSDEBUG, client.getNickname()).trailing(text).end());
 		}
 	}
-}
 
-void Commands::handleQuitCommand(const std::string& msg, Client& client)
-{
-	std::string shapedMsg = msg;
-	shapedMsg.erase(0, 6);
-	std::string quitMsg = ":" + client.getNickname() + " QUIT :" + shapedMsg + "\r\n";
-	send(client.getFd(), quitMsg.c_str(), quitMsg.size(), 0);
-	if (!client.getJoinedChannels().empty())
+	else if (query == 't')
 	{
-		std::vector<std::string> channelsList = client.getJoinedChannels();
-		std::vector<std::string>::iterator it = channelsList.begin();
-		std::vector<std::string>::iterator ite = channelsList.end();
-		while (it != ite)
+		if (!client.getIsOper())
 		{
-			std::string channelName = *it;
-			if (channels.find(channelName) != channels.end())
-			{
-				std::vector<Client>& users = channels[channelName].getUsers();
-				std::vector<Client>::iterator userIt = users.begin();
-				std::vector<Client>::iterator userIte = users.end();
-				while (userIt != userIte)
-				{
-					if (userIt->getFd() != client.getFd())
-						send(userIt->getFd(), quitMsg.c_str(), quitMsg.size(), 0);
-					userIt++;
-				}
-				channels[channelName].removeUser(client);
-				channels[channelName].removeOp(client.getNickname());
-				if (channels[channelName].getUsers().size() == 1)
-					channels.erase(channelName);
-			}
-			it++;
+			server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOPRIVILEGES, client.getNickname()).end());
+			return;
 		}
+		std::string result;
+		server.dumpTrace(result);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_STATSDEBUG, client.getNickname()).trailing("trace: ").append(result).end());
 	}
-	server.removeNick(client.getNickname());
-	client.clearBuffer();
+
+	server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_ENDOFSTATS, client.getNickname()).param(&query, 1).end());
 }
 
-void Commands::createBot()
+// Compares every byte whatever the first mismatch, so the time taken does not
+// tell how much of a guess was right.
+static bool sameSecret(const std::string& a, const std::string& b)
 {
-	if (botExists)
-		return;
-		
-	Client bot(BOT_FD);
-	bot.setNickname("IrcBot");
-	bot.setUsername("bot");
-	bot.setRealname("IRC Helper Bot");
-	bot.setHostname("server");
-	bot.setIsAuth(true);
-
-	clients.insert(std::make_pair(BOT_FD, bot));
-
-	std::string botNick = "IrcBot";
-	std::string botUser = "bot";
-	server.addNick(botNick);
-
-	botExists = true;
+	unsigned char diff = a.size() != b.size();
+	for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+		diff |= a[i] ^ b[i];
+	return diff == 0;
 }
 
-void Commands::botJoinChannel(const std::string& channelName)
+// "OPER <name> <password>" against the one --oper credential. Operators may
+// use STATS t; nothing else depends on it.
+void Commands::handleOperCommand(const ircMessage& msg, Client& client)
 {
-	if (!botExists)
-		createBot();
-		
-	std::map<int, Client>::iterator botIt = clients.find(BOT_FD);
-	if (botIt == clients.end())
+	if (msg.paramCount < 2)
+	{
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NEEDMOREPARAMS, client.getNickname()).param("OPER").end());
 		return;
-
-	Client& bot = botIt->second;
-
-	if (channels.find(channelName) != channels.end())
+	}
+	if (operName.empty())
 	{
-		std::vector<Client>& users = channels[channelName].getUsers();
-		for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
-			if (it->getFd() == BOT_FD)
-				return;
-		channels[channelName].addUser(bot);
-		channels[channelName].addOp("IrcBot");
-		bot.joinChannel(channelName);
-		
-		std::string joinMsg = ":IrcBot!bot@server JOIN :" + channelName + "\r\n";
-		for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
-			if (it->getFd() != BOT_FD && it->getFd() != -1)
-				send(it->getFd(), joinMsg.c_str(), joinMsg.length(), 0);
-		
-		std::string modeMsg = ":IrcBot MODE " + channelName + " +o IrcBot\r\n";
-		for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
-			if (it->getFd() != BOT_FD && it->getFd() != -1)
-				send(it->getFd(), modeMsg.c_str(), modeMsg.length(), 0);
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_NOOPERHOST, client.getNickname()).end());
+		return;
+	}
+	bool nameOk = sameSecret(toString(msg.params[0]), operName);
+	bool passwordOk = sameSecret(toString(msg.params[1]), operPassword);
+	if (!nameOk || !passwordOk)
+	{
+		server.queueMessage(client.getFd(), reply.numeric(Reply::ERR_PASSWDMISMATCH, client.getNickname()).end());
+		return;
 	}
+	client.setIsOper(true);
+	server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_YOUREOPER, client.getNickname()).end());
 }
 
-void Commands::botGreetUser(const std::string& channelName, const std::string& nickname)
+// Rebuilds the channel's NAMES chunks if something invalidated them, then
+// sends one 353 per chunk. Joining a large channel therefore costs a copy of
+// the cached list rather than a lookup of every member.
+void Commands::sendNames(Channel& channel, const Client& client)
 {
-	if (!botExists || channels.find(channelName) == channels.end())
-		return;
-
-	std::vector<Client>& users = channels[channelName].getUsers();
-	for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
+	if (!channel.hasNames())
 	{
-		if (it->getNickname() == nickname && it->getFd() != BOT_FD)
+		channel.resetNames();
+		const std::vector<channelMember>& members = channel.getMembers();
+		for (std::vector<channelMember>::const_iterator it = members.begin(); it != members.end(); ++it)
 		{
-			std::string greetMsg = ":IrcBot!bot@server PRIVMSG " + channelName + " :Welcome to " + channelName + ", " + nickname + "!\r\n";
-			for (std::vector<Client>::iterator userIt = users.begin(); userIt != users.end(); ++userIt)
-				if (userIt->getFd() != BOT_FD && userIt->getFd() != -1)
-					send(userIt->getFd(), greetMsg.c_str(), greetMsg.length(), 0);
-			break;
+			Client *member = memberClient(*it);
+			if (member != NULL)
+				channel.addName(it->fd, member->getNickname());
 		}
 	}
+
+	const std::vector<std::string>& chunks = channel.getNames();
+	for (std::vector<std::string>::const_iterator it = chunks.begin(); it != chunks.end(); ++it)
+	{
+		reply.numeric(Reply::RPL_NAMREPLY, client.getNickname()).param("=").param(channel.getName()).trailing(*it);
+		server.queueMessage(client.getFd(), reply.end());
+	}
+	server.queueMessage(client.getFd(), reply.numeric(Reply::RPL_ENDOFNAMES, client.getNickname()).param(channel.getName()).end());
 }
 
-void Commands::botGiveOpToUser(const std::string& channelName, const std::string& nickname)
+void Commands::handleQuitCommand(const ircMessage& msg, Client& client)
 {
-	if (!botExists || channels.find(channelName) == channels.end())
-		return;
-	bool shouldGiveOP = false;
-	if (nickname == "abakirca" || nickname == "naanapa" || nickname == "mbaypara" || nickname == "Myxoceph")
-		shouldGiveOP = true;
-
-	if (shouldGiveOP)
+	reply.command(client.getPrefix(), "QUIT").trailing();
+	if (msg.paramCount > 0)
+		reply.append(msg.params[0].data, msg.params[0].size);
+	MessageBuffer quitMsg(reply.end());
+	server.queueMessage(client.getFd(), quitMsg);
+	if (!client.getJoinedChannels().empty())
 	{
-		if (channels[channelName].isOp(nickname))
-			return;
-
-		channels[channelName].addOp(nickname);
-		
-		std::string modeMsg = ":IrcBot MODE " + channelName + " +o " + nickname + "\r\n";
-
-		std::vector<Client>& users = channels[channelName].getUsers();
-		for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
-		{
-			if (it->getFd() != BOT_FD && it->getFd() != -1)
-				send(it->getFd(), modeMsg.c_str(), modeMsg.length(), 0);
-		}
-
-		for (std::vector<Client>::iterator it = users.begin(); it != users.end(); ++it)
+		beginDelivery();
+		markDelivered(client.getFd());
+		std::vector<nameId> channelsList = client.getJoinedChannels();
+		std::vector<nameId>::iterator it = channelsList.begin();
+		std::vector<nameId>::iterator ite = channelsList.end();
+		while (it != ite)
 		{
-			if (it->getNickname() == nickname && it->getFd() != -1)
+			channelMap::iterator channel = channels.find(*it);
+			if (channel != channels.end())
 			{
-				std::string privMsg = ":IrcBot!bot@server NOTICE " + nickname + " :Welcome, Admin. I have granted you the operator privileges.\r\n";
-				send(it->getFd(), privMsg.c_str(), privMsg.length(), 0);
-				break;
+				broadcastOnce(channel->second, quitMsg);
+				removeMember(channel->second, client);
+				if (!channel->second.hasUsers())
+					dropChannel(channel->second);
 			}
+			client.partChannel(*it);
+			it++;
 		}
 	}
+	server.removeNick(client);
+	client.clearBuffer();
+}
+
+Channel *Commands::findChannel(nameId id)
+{
+	channelMap::iterator it = channels.find(id);
+	return it == channels.end() ? NULL : &it->second;
+}
+
+Client *Commands::findClient(int fd, unsigned long id)
+{
+	return clients.find(fd, id);
+}
+
+bool Commands::registerService(Client& service, const std::string& nickname)
+{
+	return server.setNick(service, nickname);
+}
+
+// Services join with operator status and announce it like a channel creator.
+void Commands::serviceJoin(Client& service, Channel& channel)
+{
+	if (!channel.addMember(service.getFd(), channelMember::OP | channelMember::SERVICE, service.getNickname()))
+		return;
+	service.joinChannel(channel.getId());
+
+	const std::string& channelName = channel.getName();
+	std::string joinMsg = reply.command(service.getPrefix(), "JOIN").trailing(channelName).end();
+	joinMsg += reply.command(service.getNickname(), "MODE").param(channelName).param("+o").param(service.getNickname()).end();
+	broadcast(channel, joinMsg);
+}
+
+void Commands::serviceMessage(Client& service, Channel& channel, const std::string& text)
+{
+	broadcast(channel, reply.command(service.getPrefix(), "PRIVMSG").param(channel.getName()).trailing(text).end());
+}
+
+void Commands::serviceNotice(Client& service, const Client& target, const std::string& text)
+{
+	server.queueMessage(target.getFd(), reply.command(service.getPrefix(), "NOTICE").param(target.getNickname()).trailing(text).end());
 }
 
-bool Commands::isBotCreated() const
+void Commands::serviceOp(Client& service, Channel& channel, const Client& target)
 {
-	return botExists;
+	channel.setOp(target.getFd(), true, target.getNickname());
+	broadcast(channel, reply.command(service.getNickname(), "MODE").param(channel.getName()).param("+o").param(target.getNickname()).end());
 }
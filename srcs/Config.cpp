@@ -0,0 +1,223 @@
+#include "Config.hpp"
+#include "Uring.hpp"
+#include "Logger.hpp"
+#include <stdexcept>
+#include <cstdlib>
+#include <iostream>
+
+#define RED "\033[1;31m"
+#define GREEN "\033[1;32m"
+#define WHITE "\033[1;37m"
+#define RESET "\033[0m"
+
+// Bytes a client may have queued but not yet written before it is dropped.
+static const size_t DEFAULT_SENDQ = 262144;
+
+static size_t parseSize(const std::string& value, const std::string& opt)
+{
+	char *end = NULL;
+	long num = std::strtol(value.c_str(), &end, 10);
+
+	if (value.empty() || *end != '\0' || num <= 0)
+		throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+	return static_cast<size_t>(num);
+}
+
+static int parseCount(const std::string& value, const std::string& opt, int max)
+{
+	size_t num = parseSize(value, opt);
+
+	if (num > static_cast<size_t>(max))
+		throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+	return static_cast<int>(num);
+}
+
+static const int MAX_THREADS = 64;
+static const char *DEFAULT_SERVER_NAME = "server";
+static const size_t MAX_SERVER_NAME = 63;
+static const int DEFAULT_BACKLOG = 511;
+static const int MAX_BACKLOG = 65535;
+static const int DEFAULT_ACCEPT_BUDGET = 64;
+static const int MAX_ACCEPT_BUDGET = 4096;
+static const int MAX_TRACE_EVENTS = 1 << 20;
+static const char *DEFAULT_TRACE_FILE = "ircserv-trace.json";
+
+// The name is the source of every numeric, so it has to be a single token,
+// and no longer than a host name so replies keep room for their content.
+static std::string parseServerName(const std::string& value, const std::string& opt)
+{
+	if (value.empty() || value.size() > MAX_SERVER_NAME || value.find_first_of(" :\r\n") != std::string::npos)
+		throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+	return value;
+}
+
+static bool parseSwitch(const std::string& value, const std::string& opt)
+{
+	if (value == "on")
+		return true;
+	if (value == "off")
+		return false;
+	throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+}
+
+// An empty list is allowed and leaves the bot without admins.
+static std::vector<std::string> parseNickList(const std::string& value, const std::string& opt)
+{
+	std::vector<std::string> nicks;
+	std::string::size_type start = 0;
+
+	while (start < value.size())
+	{
+		std::string::size_type comma = value.find(',', start);
+		if (comma == std::string::npos)
+			comma = value.size();
+		std::string nick = value.substr(start, comma - start);
+		if (nick.empty() || nick.find_first_of(" :\r\n") != std::string::npos)
+			throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+		nicks.push_back(nick);
+		start = comma + 1;
+	}
+	return nicks;
+}
+
+// "name:password", the one credential OPER accepts.
+static void parseOper(const std::string& value, const std::string& opt, serverConfig& config)
+{
+	std::string::size_type colon = value.find(':');
+	if (colon == 0 || colon == std::string::npos || colon + 1 == value.size()
+		|| value.find_first_of(" \r\n") != std::string::npos)
+		throw std::invalid_argument(RED"Invalid value for " + opt + ": expected name:password" RESET);
+	config.operName = value.substr(0, colon);
+	config.operPassword = value.substr(colon + 1);
+}
+
+static int parseLevel(const std::string& value, const std::string& opt)
+{
+	int level = Logger::parseLevel(value);
+	if (level < 0)
+		throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+	return level;
+}
+
+// "message:100,conn:1": log one line in n for each named category, none for 0.
+static void parseSampling(const std::string& value, const std::string& opt, std::vector<unsigned>& sample)
+{
+	std::string::size_type start = 0;
+
+	while (start < value.size())
+	{
+		std::string::size_type comma = value.find(',', start);
+		if (comma == std::string::npos)
+			comma = value.size();
+		std::string entry = value.substr(start, comma - start);
+		std::string::size_type colon = entry.find(':');
+		int category = colon == std::string::npos ? -1 : Logger::parseCategory(entry.substr(0, colon));
+		char *end = NULL;
+		long n = colon == std::string::npos ? -1 : std::strtol(entry.c_str() + colon + 1, &end, 10);
+		if (category < 0 || n < 0 || colon + 1 == entry.size() || *end != '\0')
+			throw std::invalid_argument(RED"Invalid value for " + opt + ": " + value + RESET);
+		sample[category] = static_cast<unsigned>(n);
+		start = comma + 1;
+	}
+}
+
+static std::string defaultBackend()
+{
+#ifdef __linux__
+	return "epoll";
+#else
+	return "poll";
+#endif
+}
+
+std::string Config::usage(const std::string& program)
+{
+	return GREEN"Usage: " WHITE"\"" + program + "\" \"port\" \"password\" [options]\n"
+		GREEN"Options: " WHITE"--backend=poll|epoll|uring --server-name=name --sendq=bytes --threads=n --backlog=n --accept-budget=n --services=on|off --bot-admins=nick,... --oper=name:password\n"
+		"         --metrics-socket=path --log-level=debug|info|warn|error --log-file=path --log-sample=category:n,...\n"
+		"         --trace=events --trace-file=path --capture=path" RESET;
+}
+
+serverConfig Config::parse(int ac, char **av)
+{
+	serverConfig config;
+
+	if (ac < 3)
+		throw std::invalid_argument(RED"Wrong inputs.\n" + usage(av[0]));
+
+	config.port = av[1];
+	config.pwd = av[2];
+	config.backend = defaultBackend();
+	config.serverName = DEFAULT_SERVER_NAME;
+	config.sendqLimit = DEFAULT_SENDQ;
+	config.threads = 1;
+	config.backlog = DEFAULT_BACKLOG;
+	config.acceptBudget = DEFAULT_ACCEPT_BUDGET;
+	config.services = true;
+	config.botAdmins.clear(); // nicks are not authenticated, so nobody is an admin unless named
+	config.operName = "";
+	config.operPassword = "";
+	config.metricsSocket = "";
+	config.logLevel = Logger::INFO;
+	config.logFile = "";
+	config.logSample.assign(Logger::CATEGORY_COUNT, 1);
+	config.traceEvents = 0;
+	config.traceFile = DEFAULT_TRACE_FILE;
+	config.captureFile = "";
+
+	for (int i = 3; i < ac; i++)
+	{
+		std::string opt = av[i];
+		std::string::size_type eq = opt.find('=');
+		std::string key = opt.substr(0, eq);
+		std::string value = (eq == std::string::npos) ? "" : opt.substr(eq + 1);
+
+		if (key == "--backend" && !value.empty())
+			config.backend = value;
+		else if (key == "--server-name")
+			config.serverName = parseServerName(value, key);
+		else if (key == "--sendq")
+			config.sendqLimit = parseSize(value, key);
+		else if (key == "--threads")
+			config.threads = parseCount(value, key, MAX_THREADS);
+		else if (key == "--backlog")
+			config.backlog = parseCount(value, key, MAX_BACKLOG);
+		else if (key == "--accept-budget")
+			config.acceptBudget = parseCount(value, key, MAX_ACCEPT_BUDGET);
+		else if (key == "--services")
+			config.services = parseSwitch(value, key);
+		else if (key == "--bot-admins")
+			config.botAdmins = parseNickList(value, key);
+		else if (key == "--oper")
+			parseOper(value, key, config);
+		else if (key == "--metrics-socket")
+			config.metricsSocket = value;
+		else if (key == "--log-level")
+			config.logLevel = parseLevel(value, key);
+		else if (key == "--log-file")
+			config.logFile = value;
+		else if (key == "--log-sample")
+			parseSampling(value, key, config.logSample);
+		else if (key == "--trace")
+			config.traceEvents = parseCount(value, key, MAX_TRACE_EVENTS);
+		else if (key == "--trace-file" && !value.empty())
+			config.traceFile = value;
+		else if (key == "--capture")
+			config.captureFile = value;
+		else
+			throw std::invalid_argument(RED"Unknown option: " + opt + "\n" + usage(av[0]));
+	}
+
+	if (config.backend == "uring")
+	{
+#ifdef __linux__
+		if (!Uring::isSupported())
+#endif
+		{
+			std::cerr << "Warning: io_uring is not available, falling back to poll" << std::endl;
+			config.backend = "poll";
+		}
+	}
+
+	return config;
+}
@@ -0,0 +1,50 @@
+#include "IrcBot.hpp"
+#include "Channel.hpp"
+
+const char *IrcBot::NICKNAME = "IrcBot";
+
+IrcBot::IrcBot(int fd, const std::vector<std::string>& admins) : Service(fd), admins(admins)
+{
+
+}
+
+bool IrcBot::isAdmin(const std::string& nickname) const
+{
+	for (size_t i = 0; i < admins.size(); ++i)
+		if (NameTable::equal(admins[i], nickname))
+			return true;
+	return false;
+}
+
+int IrcBot::subscriptions() const
+{
+	return serviceEvent::JOIN;
+}
+
+bool IrcBot::start(ServiceHost& host)
+{
+	client.setUsername("bot");
+	client.setRealname("IRC Helper Bot");
+	client.setHostname("server");
+	client.setIsAuth(true);
+	return host.registerService(client, NICKNAME);
+}
+
+void IrcBot::handle(const serviceEvent& event, ServiceHost& host)
+{
+	Channel *channel = host.findChannel(event.channel);
+	Client *user = host.findClient(event.fd, event.clientId);
+	if (channel == NULL || user == NULL || !channel->hasMember(user->getFd()))
+		return;
+
+	host.serviceJoin(client, *channel);
+
+	const std::string& channelName = channel->getName();
+	host.serviceMessage(client, *channel, "Welcome to " + channelName + ", " + user->getNickname() + "!");
+
+	if (isAdmin(user->getNickname()) && !channel->isOp(user->getFd()))
+	{
+		host.serviceOp(client, *channel, *user);
+		host.serviceNotice(client, *user, "Welcome, Admin. I have granted you the operator privileges.");
+	}
+}
@@ -0,0 +1,100 @@
+#include "LineBuffer.hpp"
+#include <cstring>
+
+LineBuffer::LineBuffer() : start(0), scan(0), end(0), truncating(false)
+{
+
+}
+
+// Makes room for the next read and returns how many bytes may be written at
+// writePtr(). Only the unterminated tail (at most MAX_LINE bytes) is moved.
+size_t LineBuffer::reserve()
+{
+	if (storage.empty())
+		storage.resize(CAPACITY);
+
+	if (start == end)
+	{
+		start = 0;
+		scan = 0;
+		end = 0;
+	}
+	else if (start > 0)
+	{
+		std::memmove(&storage[0], &storage[start], end - start);
+		scan -= start;
+		end -= start;
+		start = 0;
+	}
+	return CAPACITY - end;
+}
+
+char *LineBuffer::writePtr()
+{
+	return &storage[end];
+}
+
+void LineBuffer::commit(size_t n)
+{
+	end += n;
+}
+
+// Views stay valid until the next reserve().
+bool LineBuffer::nextLine(lineView& out)
+{
+	while (scan < end)
+	{
+		const char *base = &storage[0];
+		const char *lf = static_cast<const char *>(std::memchr(base + scan, '\n', end - scan));
+
+		if (truncating)
+		{
+			scan = (lf == NULL) ? end : static_cast<size_t>(lf - base) + 1;
+			start = scan;
+			truncating = (lf == NULL);
+			continue;
+		}
+
+		if (lf == NULL)
+		{
+			scan = end;
+			if (end - start <= MAX_LINE - 2)
+				return false;
+			out.data = base + start;
+			out.size = MAX_LINE - 2;
+			start = end;
+			truncating = true;
+			return true;
+		}
+
+		size_t pos = lf - base;
+		scan = pos + 1;
+		if (pos == start || base[pos - 1] != '\r')
+			continue;
+
+		size_t lineStart = start;
+		size_t size = pos - 1 - start;
+		start = scan;
+		if (size == 0)
+			continue;
+		if (size > MAX_LINE - 2)
+			size = MAX_LINE - 2;
+		out.data = base + lineStart;
+		out.size = size;
+		return true;
+	}
+	return false;
+}
+
+size_t LineBuffer::pending() const
+{
+	return end - start;
+}
+
+void LineBuffer::clear()
+{
+	start = 0;
+	scan = 0;
+	end = 0;
+	truncating = false;
+}
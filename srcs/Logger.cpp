@@ -0,0 +1,234 @@
+#include "Logger.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#define RED "\033[1;31m"
+#define RESET "\033[0m"
+
+static const char *LEVEL_NAMES[Logger::LEVEL_COUNT] = { "DEBUG", "INFO", "WARN", "ERROR" };
+static const char *CATEGORY_NAMES[Logger::CATEGORY_COUNT] = { "server", "conn", "message", "io" };
+
+Logger::Logger(const serverConfig& config)
+	: ring(CAPACITY), tail(0), head(0), dropped(0), minLevel(config.logLevel), fd(STDOUT_FILENO), ownsFd(false),
+	stopping(0), threadStarted(false), stampSecond(-1)
+{
+	for (size_t i = 0; i < CAPACITY; i++)
+		ring[i].sequence = i;
+	for (int c = 0; c < CATEGORY_COUNT; c++)
+	{
+		seen[c] = 0;
+		sample[c] = static_cast<size_t>(c) < config.logSample.size() ? config.logSample[c] : 1;
+	}
+	stamp[0] = '\0';
+	wakeFds[0] = -1;
+	wakeFds[1] = -1;
+
+	if (!config.logFile.empty())
+	{
+		fd = open(config.logFile.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd == -1)
+			throw std::runtime_error(RED"Error: could not open log file " + config.logFile + ": " + strerror(errno) + RESET);
+		ownsFd = true;
+	}
+	if (pipe(wakeFds) == -1 || fcntl(wakeFds[1], F_SETFL, O_NONBLOCK) == -1)
+	{
+		std::string err = strerror(errno);
+		if (wakeFds[0] != -1)
+			close(wakeFds[0]);
+		if (wakeFds[1] != -1)
+			close(wakeFds[1]);
+		if (ownsFd)
+			close(fd);
+		throw std::runtime_error(RED"Error: pipe creation failed " + err + RESET);
+	}
+}
+
+// Whatever is still queued is written out by the calling thread, so lines
+// logged while the server shuts down, or before the thread ever ran, are
+// not lost.
+Logger::~Logger()
+{
+	stop();
+	drain();
+	flush();
+	close(wakeFds[0]);
+	close(wakeFds[1]);
+	if (ownsFd)
+		close(fd);
+}
+
+int Logger::parseLevel(const std::string& name)
+{
+	static const char *names[LEVEL_COUNT] = { "debug", "info", "warn", "error" };
+	for (int i = 0; i < LEVEL_COUNT; i++)
+		if (name == names[i])
+			return i;
+	return -1;
+}
+
+int Logger::parseCategory(const std::string& name)
+{
+	for (int i = 0; i < CATEGORY_COUNT; i++)
+		if (name == CATEGORY_NAMES[i])
+			return i;
+	return -1;
+}
+
+void Logger::log(level l, category c, const char *format, ...)
+{
+	if (!enabled(l, c))
+		return;
+	if (sample[c] > 1 && __atomic_fetch_add(&seen[c], 1, __ATOMIC_RELAXED) % sample[c] != 0)
+		return;
+
+	unsigned long pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+	record *slot;
+	while (true)
+	{
+		slot = &ring[pos & (CAPACITY - 1)];
+		long diff = static_cast<long>(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+		{
+			__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+			pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &slot->time);
+	slot->level = l;
+	slot->category = c;
+	va_list args;
+	va_start(args, format);
+	int n = std::vsnprintf(slot->text, TEXT_SIZE, format, args);
+	va_end(args);
+	slot->length = n < 0 ? 0 : (static_cast<size_t>(n) < TEXT_SIZE ? n : TEXT_SIZE - 1);
+	__atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+	// A quarter of the ring filling up between two flushes is worth an
+	// early wakeup.
+	if ((pos & (CAPACITY / 4 - 1)) == 0)
+		wake();
+}
+
+// The pipe is non-blocking; if it is full the thread is awake already.
+void Logger::wake()
+{
+	char c = 1;
+	while (write(wakeFds[1], &c, 1) == -1 && errno == EINTR)
+		;
+}
+
+// Moves every published record into the batch and frees its slot. Only the
+// writer thread, or the destructor once it has stopped, calls this.
+bool Logger::drain()
+{
+	bool any = false;
+	while (true)
+	{
+		record& slot = ring[head & (CAPACITY - 1)];
+		if (__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) != head + 1)
+			break;
+		append(slot);
+		__atomic_store_n(&slot.sequence, head + CAPACITY, __ATOMIC_RELEASE);
+		head++;
+		any = true;
+	}
+
+	unsigned long lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+	if (lost != 0)
+	{
+		char text[64];
+		std::snprintf(text, sizeof(text), "%lu log lines dropped, the ring was full\n", lost);
+		batch += text;
+		any = true;
+	}
+	return any;
+}
+
+// "2024-01-01 12:00:00.123 INFO  conn: text"
+void Logger::append(const record& r)
+{
+	if (r.time.tv_sec != stampSecond)
+	{
+		struct tm local;
+		localtime_r(&r.time.tv_sec, &local);
+		std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+		stampSecond = r.time.tv_sec;
+	}
+	char prefix[64];
+	std::snprintf(prefix, sizeof(prefix), "%s.%03ld %-5s %s: ", stamp, r.time.tv_nsec / 1000000,
+		LEVEL_NAMES[r.level], CATEGORY_NAMES[r.category]);
+	batch += prefix;
+	batch.append(r.text, r.length);
+	batch += '\n';
+}
+
+void Logger::flush()
+{
+	size_t written = 0;
+	while (written < batch.size())
+	{
+		ssize_t n = write(fd, batch.data() + written, batch.size() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		written += n;
+	}
+	batch.clear();
+}
+
+void *Logger::threadMain(void *arg)
+{
+	static_cast<Logger *>(arg)->run();
+	return NULL;
+}
+
+void Logger::run()
+{
+	struct pollfd pfd;
+	pfd.fd = wakeFds[0];
+	pfd.events = POLLIN;
+
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+	{
+		if (drain())
+			flush();
+		if (poll(&pfd, 1, FLUSH_MS) > 0)
+		{
+			char buffer[64];
+			if (read(wakeFds[0], buffer, sizeof(buffer)) < 0 && errno != EINTR)
+				break;
+		}
+	}
+}
+
+void Logger::start()
+{
+	if (pthread_create(&thread, NULL, &Logger::threadMain, this) != 0)
+		throw std::runtime_error(RED"Error: could not start log thread" RESET);
+	threadStarted = true;
+}
+
+void Logger::stop()
+{
+	if (!threadStarted)
+		return;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	wake();
+	pthread_join(thread, NULL);
+	threadStarted = false;
+}
@@ -0,0 +1,61 @@
+#include "MessageBuffer.hpp"
+
+MessageBuffer::MessageBuffer() : payload(NULL)
+{
+
+}
+
+MessageBuffer::MessageBuffer(const std::string& data) : payload(new Payload())
+{
+	payload->refs = 1;
+	payload->data = data;
+}
+
+MessageBuffer::MessageBuffer(const MessageBuffer& other) : payload(other.payload)
+{
+	if (payload != NULL)
+		__atomic_add_fetch(&payload->refs, 1, __ATOMIC_RELAXED);
+}
+
+MessageBuffer& MessageBuffer::operator=(const MessageBuffer& other)
+{
+	if (payload == other.payload)
+		return *this;
+	if (other.payload != NULL)
+		__atomic_add_fetch(&other.payload->refs, 1, __ATOMIC_RELAXED);
+	release();
+	payload = other.payload;
+	return *this;
+}
+
+MessageBuffer::~MessageBuffer()
+{
+	release();
+}
+
+void MessageBuffer::release()
+{
+	if (payload != NULL && __atomic_sub_fetch(&payload->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		delete payload;
+	payload = NULL;
+}
+
+const char *MessageBuffer::data() const
+{
+	return payload == NULL ? "" : payload->data.data();
+}
+
+size_t MessageBuffer::size() const
+{
+	return payload == NULL ? 0 : payload->data.size();
+}
+
+bool MessageBuffer::empty() const
+{
+	return size() == 0;
+}
+
+int MessageBuffer::useCount() const
+{
+	return payload == NULL ? 0 : __atomic_load_n(&payload->refs, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,234 @@
+#include "Metrics.hpp"
+#include "Reply.hpp"
+#include <cstring>
+#include <cstdio>
+
+const char *Metrics::COMMAND_NAMES[COMMAND_COUNT] =
+{
+	"PASS", "NICK", "USER", "JOIN", "PART", "PRIVMSG", "MODE", "TOPIC",
+	"KICK", "INVITE", "NAMES", "QUIT", "STATS", "OPER", "UNKNOWN"
+};
+
+Metrics::Metrics(int shardCount) : started(std::time(NULL))
+{
+	block empty;
+	std::memset(&empty, 0, sizeof(empty));
+	shards.assign(shardCount, empty);
+	std::memset(&core, 0, sizeof(core));
+	std::memset(gauges, 0, sizeof(gauges));
+	std::memset(commandCounts, 0, sizeof(commandCounts));
+	std::memset(commandBytes, 0, sizeof(commandBytes));
+	std::memset(commandTime, 0, sizeof(commandTime));
+	std::memset(&fanout, 0, sizeof(fanout));
+}
+
+unsigned long long Metrics::nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long long Metrics::load(const unsigned long long& slot)
+{
+	return __atomic_load_n(&slot, __ATOMIC_RELAXED);
+}
+
+void Metrics::collect(const histogram& from, histogram& into)
+{
+	for (int i = 0; i < BUCKETS; i++)
+		into.buckets[i] += load(from.buckets[i]);
+	into.count += load(from.count);
+	into.sum += load(from.sum);
+}
+
+// Counters such as bytes read are kept per shard and summed here.
+unsigned long long Metrics::get(counter c) const
+{
+	unsigned long long total = load(core.counters[c]);
+	for (size_t i = 0; i < shards.size(); i++)
+		total += load(shards[i].counters[c]);
+	return total;
+}
+
+unsigned long long Metrics::get(gauge g) const
+{
+	return load(gauges[g]);
+}
+
+unsigned long long Metrics::getCommandCount(command cmd) const
+{
+	return load(commandCounts[cmd]);
+}
+
+unsigned long long Metrics::getCommandBytes(command cmd) const
+{
+	return load(commandBytes[cmd]);
+}
+
+void Metrics::getCommandTime(command cmd, histogram& out) const
+{
+	std::memset(&out, 0, sizeof(out));
+	collect(commandTime[cmd], out);
+}
+
+void Metrics::getLoopTime(histogram& out) const
+{
+	std::memset(&out, 0, sizeof(out));
+	for (size_t i = 0; i < shards.size(); i++)
+		collect(shards[i].loopTime, out);
+}
+
+void Metrics::getFanout(histogram& out) const
+{
+	std::memset(&out, 0, sizeof(out));
+	collect(fanout, out);
+}
+
+std::time_t Metrics::getStarted() const
+{
+	return started;
+}
+
+// Upper bound of the bucket the p-th fraction of observations falls in, so
+// the answer is within a factor of two of the true value.
+unsigned long long Metrics::percentile(const histogram& h, double p)
+{
+	if (h.count == 0)
+		return 0;
+	unsigned long long rank = static_cast<unsigned long long>(p * h.count);
+	if (rank == 0)
+		rank = 1;
+	unsigned long long seen = 0;
+	for (int i = 0; i < BUCKETS; i++)
+	{
+		seen += h.buckets[i];
+		if (seen >= rank)
+			return (1ULL << i) - 1;
+	}
+	return (1ULL << (BUCKETS - 1)) - 1;
+}
+
+static void appendDouble(std::string& out, double value)
+{
+	char text[32];
+	std::snprintf(text, sizeof(text), "%.9g", value);
+	out += text;
+}
+
+static void appendSample(std::string& out, const char *name, const char *suffix, const std::string& labels, unsigned long long value)
+{
+	out += name;
+	out += suffix;
+	if (!labels.empty())
+		out += "{" + labels + "}";
+	out += ' ';
+	Reply::appendNumber(out, value);
+	out += '\n';
+}
+
+static void appendHeader(std::string& out, const char *name, const char *type, const char *help)
+{
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+// Every value in bucket i is below 2^i, so the cumulative count up to bucket
+// i is exact for le = (2^i - 1) * scale. Only every step-th bucket is
+// written, which keeps the series count down without losing accuracy for
+// the buckets that are. The last bucket also takes everything larger, so it
+// is only covered by +Inf.
+void Metrics::renderHistogram(std::string& out, const char *name, const std::string& labels,
+	const histogram& h, int firstBucket, int step, double scale)
+{
+	std::string prefix = labels.empty() ? "" : labels + ",";
+	unsigned long long cumulative = 0;
+
+	for (int i = 0; i < BUCKETS; i++)
+	{
+		cumulative += h.buckets[i];
+		if (i < firstBucket || (i - firstBucket) % step != 0 || i == BUCKETS - 1)
+			continue;
+		out += name;
+		out += "_bucket{" + prefix + "le=\"";
+		appendDouble(out, ((1ULL << i) - 1) * scale);
+		out += "\"} ";
+		Reply::appendNumber(out, cumulative);
+		out += '\n';
+	}
+	out += name;
+	out += "_bucket{" + prefix + "le=\"+Inf\"} ";
+	Reply::appendNumber(out, h.count);
+	out += "\n";
+	out += name;
+	out += "_sum";
+	if (!labels.empty())
+		out += "{" + labels + "}";
+	out += ' ';
+	appendDouble(out, h.sum * scale);
+	out += '\n';
+	appendSample(out, name, "_count", labels, h.count);
+}
+
+// Prometheus text exposition format, version 0.0.4.
+std::string Metrics::render() const
+{
+	static const struct
+	{
+		counter		id;
+		const char	*name;
+		const char	*help;
+	} counters[] =
+	{
+		{ BYTES_READ, "ircserv_read_bytes_total", "Bytes read from client sockets." },
+		{ BYTES_WRITTEN, "ircserv_written_bytes_total", "Bytes written to client sockets." },
+		{ LINES_PARSED, "ircserv_lines_parsed_total", "Protocol lines parsed." },
+		{ FANOUT_MESSAGES, "ircserv_fanout_messages_total", "Messages sent to a channel." },
+		{ FANOUT_RECIPIENTS, "ircserv_fanout_recipients_total", "Copies queued for channel messages." },
+		{ LOOP_ITERATIONS, "ircserv_loop_iterations_total", "Event loop iterations across all shards." }
+	};
+	std::string out;
+	histogram h;
+
+	for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+	{
+		appendHeader(out, counters[i].name, "counter", counters[i].help);
+		appendSample(out, counters[i].name, "", "", get(counters[i].id));
+	}
+
+	appendHeader(out, "ircserv_clients", "gauge", "Connected clients.");
+	appendSample(out, "ircserv_clients", "", "", get(CLIENTS));
+	appendHeader(out, "ircserv_channels", "gauge", "Existing channels.");
+	appendSample(out, "ircserv_channels", "", "", get(CHANNELS));
+	appendHeader(out, "ircserv_start_time_seconds", "gauge", "Start time of the server since the Unix epoch.");
+	appendSample(out, "ircserv_start_time_seconds", "", "", started);
+
+	appendHeader(out, "ircserv_commands_total", "counter", "Commands handled, by command.");
+	for (int c = 0; c < COMMAND_COUNT; c++)
+		appendSample(out, "ircserv_commands_total", "", std::string("command=\"") + COMMAND_NAMES[c] + "\"", getCommandCount(static_cast<command>(c)));
+	appendHeader(out, "ircserv_command_bytes_total", "counter", "Bytes of command lines handled, by command.");
+	for (int c = 0; c < COMMAND_COUNT; c++)
+		appendSample(out, "ircserv_command_bytes_total", "", std::string("command=\"") + COMMAND_NAMES[c] + "\"", getCommandBytes(static_cast<command>(c)));
+	appendHeader(out, "ircserv_command_duration_seconds", "histogram", "Time spent handling a command, by command.");
+	for (int c = 0; c < COMMAND_COUNT; c++)
+	{
+		getCommandTime(static_cast<command>(c), h);
+		renderHistogram(out, "ircserv_command_duration_seconds", std::string("command=\"") + COMMAND_NAMES[c] + "\"", h, 8, 2, 1e-9);
+	}
+
+	getLoopTime(h);
+	appendHeader(out, "ircserv_loop_duration_seconds", "histogram", "Time spent handling the events of one loop iteration.");
+	renderHistogram(out, "ircserv_loop_duration_seconds", "", h, 8, 2, 1e-9);
+
+	getFanout(h);
+	appendHeader(out, "ircserv_fanout_recipients", "histogram", "Recipients per channel message.");
+	renderHistogram(out, "ircserv_fanout_recipients", "", h, 1, 2, 1);
+	return out;
+}
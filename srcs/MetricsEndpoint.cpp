@@ -0,0 +1,173 @@
+#include "MetricsEndpoint.hpp"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#define RED "\033[1;31m"
+#define RESET "\033[0m"
+
+// How long a connection may take to send its request line before it is
+// treated as a plain reader, and to take the response.
+static const int REQUEST_WAIT_MS = 200;
+static const int SEND_TIMEOUT_S = 2;
+
+MetricsEndpoint::MetricsEndpoint(const Metrics& metrics, Logger& logger, const std::string& path)
+	: metrics(metrics), logger(logger), path(path), listen_fd(-1), threadStarted(false)
+{
+	wakeFds[0] = -1;
+	wakeFds[1] = -1;
+	try
+	{
+		if (pipe(wakeFds) == -1)
+			throw std::runtime_error(RED"Error: pipe creation failed " + std::string(strerror(errno)) + RESET);
+		openSocket();
+	}
+	catch (...)
+	{
+		if (wakeFds[0] != -1)
+			close(wakeFds[0]);
+		if (wakeFds[1] != -1)
+			close(wakeFds[1]);
+		throw;
+	}
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+	stop();
+	close(listen_fd);
+	unlink(path.c_str());
+	close(wakeFds[0]);
+	close(wakeFds[1]);
+}
+
+// A socket left behind by an earlier run is replaced; anything else at the
+// path is not ours to remove.
+void MetricsEndpoint::openSocket()
+{
+	struct sockaddr_un address;
+	struct stat st;
+
+	if (path.size() >= sizeof(address.sun_path))
+		throw std::runtime_error(RED"Error: metrics socket path is too long: " + path + RESET);
+	if (lstat(path.c_str(), &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode))
+			throw std::runtime_error(RED"Error: " + path + " exists and is not a socket" + RESET);
+		unlink(path.c_str());
+	}
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd == -1)
+		throw std::runtime_error(RED"Error: socket creation failed " + std::string(strerror(errno)) + RESET);
+
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+	if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0)
+	{
+		std::string err = strerror(errno);
+		close(listen_fd);
+		listen_fd = -1;
+		throw std::runtime_error(RED"Error: could not listen on " + path + ": " + err + RESET);
+	}
+	chmod(path.c_str(), 0660);
+}
+
+void *MetricsEndpoint::threadMain(void *arg)
+{
+	static_cast<MetricsEndpoint *>(arg)->serve();
+	return NULL;
+}
+
+void MetricsEndpoint::start()
+{
+	if (pthread_create(&thread, NULL, &MetricsEndpoint::threadMain, this) != 0)
+		throw std::runtime_error(RED"Error: could not start metrics thread" RESET);
+	threadStarted = true;
+}
+
+void MetricsEndpoint::stop()
+{
+	if (!threadStarted)
+		return;
+	char c = 1;
+	if (write(wakeFds[1], &c, 1) == -1)
+		logger.log(Logger::ERROR, Logger::SERVER, "could not stop the metrics thread: %s", strerror(errno));
+	pthread_join(thread, NULL);
+	threadStarted = false;
+}
+
+void MetricsEndpoint::serve()
+{
+	struct pollfd fds[2];
+	fds[0].fd = listen_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = wakeFds[0];
+	fds[1].events = POLLIN;
+
+	while (true)
+	{
+		if (poll(fds, 2, -1) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			logger.log(Logger::ERROR, Logger::SERVER, "could not poll the metrics socket: %s", strerror(errno));
+			return;
+		}
+		if (fds[1].revents != 0)
+			return;
+		if (fds[0].revents == 0)
+			continue;
+
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd == -1)
+			continue;
+		answer(fd);
+		close(fd);
+	}
+}
+
+void MetricsEndpoint::answer(int fd)
+{
+	struct timeval timeout;
+	timeout.tv_sec = SEND_TIMEOUT_S;
+	timeout.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	char request[1024];
+	ssize_t n = 0;
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, REQUEST_WAIT_MS) == 1)
+		n = recv(fd, request, sizeof(request), MSG_DONTWAIT);
+
+	std::string body = metrics.render();
+	std::string response;
+	if (n >= 4 && std::memcmp(request, "GET ", 4) == 0)
+	{
+		response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+		char length[24];
+		std::snprintf(length, sizeof(length), "%lu", static_cast<unsigned long>(body.size()));
+		response += length;
+		response += "\r\nConnection: close\r\n\r\n";
+	}
+	response += body;
+
+	size_t sent = 0;
+	while (sent < response.size())
+	{
+		ssize_t w = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+		if (w <= 0)
+			return;
+		sent += w;
+	}
+}
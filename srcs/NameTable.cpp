@@ -0,0 +1,170 @@
+#include "NameTable.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static unsigned long long rotl(unsigned long long x, int b)
+{
+	return (x << b) | (x >> (64 - b));
+}
+
+static void sipRound(unsigned long long v[4])
+{
+	v[0] += v[1]; v[1] = rotl(v[1], 13); v[1] ^= v[0]; v[0] = rotl(v[0], 32);
+	v[2] += v[3]; v[3] = rotl(v[3], 16); v[3] ^= v[2];
+	v[0] += v[3]; v[3] = rotl(v[3], 21); v[3] ^= v[0];
+	v[2] += v[1]; v[1] = rotl(v[1], 17); v[1] ^= v[2]; v[2] = rotl(v[2], 32);
+}
+
+// SipHash-2-4 of len bytes under the 128-bit key (k0, k1).
+static unsigned long long sipHash(const char *data, size_t len, unsigned long long k0, unsigned long long k1)
+{
+	unsigned long long v[4];
+	v[0] = k0 ^ 0x736f6d6570736575ULL;
+	v[1] = k1 ^ 0x646f72616e646f6dULL;
+	v[2] = k0 ^ 0x6c7967656e657261ULL;
+	v[3] = k1 ^ 0x7465646279746573ULL;
+
+	const unsigned char *in = reinterpret_cast<const unsigned char *>(data);
+	size_t whole = len - len % 8;
+	for (size_t i = 0; i < whole; i += 8)
+	{
+		unsigned long long m = 0;
+		for (int b = 0; b < 8; b++)
+			m |= static_cast<unsigned long long>(in[i + b]) << (8 * b);
+		v[3] ^= m;
+		sipRound(v);
+		sipRound(v);
+		v[0] ^= m;
+	}
+
+	unsigned long long last = static_cast<unsigned long long>(len & 0xff) << 56;
+	for (size_t b = 0; b < len % 8; b++)
+		last |= static_cast<unsigned long long>(in[whole + b]) << (8 * b);
+	v[3] ^= last;
+	sipRound(v);
+	sipRound(v);
+	v[0] ^= last;
+
+	v[2] ^= 0xff;
+	for (int r = 0; r < 4; r++)
+		sipRound(v);
+	return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+bool NameTable::nameKey::operator==(const nameKey& other) const
+{
+	return hash == other.hash && folded == other.folded;
+}
+
+size_t NameTable::keyHash::operator()(const nameKey& key) const
+{
+	return key.hash;
+}
+
+NameTable::NameTable()
+{
+	seed();
+	// Id 0 is NONE and never handed out.
+	entries.resize(1);
+	entries[0].refs = 0;
+}
+
+// The key only has to be unknown to clients, so the clock and pid are an
+// acceptable fallback when /dev/urandom cannot be read.
+void NameTable::seed()
+{
+	unsigned long long key[2];
+	int fd = open("/dev/urandom", O_RDONLY);
+	bool ok = fd != -1 && read(fd, key, sizeof(key)) == static_cast<ssize_t>(sizeof(key));
+	if (fd != -1)
+		close(fd);
+	if (!ok)
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		key[0] = (static_cast<unsigned long long>(tv.tv_sec) << 20) ^ tv.tv_usec;
+		key[1] = (static_cast<unsigned long long>(getpid()) << 32) ^ reinterpret_cast<unsigned long>(this);
+	}
+	k0 = key[0];
+	k1 = key[1];
+}
+
+// RFC 1459: letters are case-insensitive and {}|^ are the lower case forms
+// of []\~.
+char NameTable::fold(char c)
+{
+	if (c >= 'A' && c <= '^')
+		return c + ('a' - 'A');
+	return c;
+}
+
+bool NameTable::equal(const std::string& a, const std::string& b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (fold(a[i]) != fold(b[i]))
+			return false;
+	return true;
+}
+
+void NameTable::makeKey(const std::string& name, nameKey& key) const
+{
+	key.folded.resize(name.size());
+	for (size_t i = 0; i < name.size(); i++)
+		key.folded[i] = fold(name[i]);
+	key.hash = static_cast<size_t>(sipHash(key.folded.data(), key.folded.size(), k0, k1));
+}
+
+// Returns NONE if the name has not been interned.
+nameId NameTable::find(const std::string& name) const
+{
+	makeKey(name, scratch);
+	std::tr1::unordered_map<nameKey, nameId, keyHash>::const_iterator it = index.find(scratch);
+	return it == index.end() ? NONE : it->second;
+}
+
+// Interns the name if needed and takes a reference on it.
+nameId NameTable::acquire(const std::string& name)
+{
+	makeKey(name, scratch);
+	std::tr1::unordered_map<nameKey, nameId, keyHash>::iterator it = index.find(scratch);
+	if (it != index.end())
+	{
+		entries[it->second].refs++;
+		return it->second;
+	}
+
+	nameId id;
+	if (!freeIds.empty())
+	{
+		id = freeIds.back();
+		freeIds.pop_back();
+	}
+	else
+	{
+		id = entries.size();
+		entries.push_back(entry());
+	}
+	entries[id].key = scratch;
+	entries[id].refs = 1;
+	index.insert(std::make_pair(scratch, id));
+	return id;
+}
+
+void NameTable::release(nameId id)
+{
+	if (id == NONE || id >= entries.size() || entries[id].refs == 0)
+		return;
+	if (--entries[id].refs > 0)
+		return;
+	index.erase(entries[id].key);
+	entries[id].key.folded.clear();
+	freeIds.push_back(id);
+}
+
+size_t NameTable::size() const
+{
+	return index.size();
+}
@@ -1,173 +1,104 @@
 #include "Parser.hpp"
-#include <iostream>
-#include <string>
-#include <vector>
+#include <cstring>
 
-std::vector<std::string> split(const std::string& s)
+static lineView makeView(const char *data, size_t size)
 {
-	std::vector<std::string> tokens;
-
-	size_t start = 0, end = 0;
-	while (start < s.length())
-	{
-		while (start < s.length() && std::isspace(s[start])) ++start;
-		if (start >= s.length()) break;
-
-		end = start;
-		while (end < s.length() && !std::isspace(s[end])) ++end;
-
-		tokens.push_back(s.substr(start, end - start));
-		start = end;
-	}
-	return tokens;
+	lineView view;
+	view.data = data;
+	view.size = size;
+	return view;
 }
 
-std::string trim(const std::string& str)
+static const char *skipSpaces(const char *pos, const char *end)
 {
-	size_t start = 0;
-	size_t end = str.size() - 1;
-
-	while (start <= end && std::isspace(str[start]))
-		++start;
-
-	while (end >= start && std::isspace(str[end]))
-		--end;
-
-	return str.substr(start, end - start + 1);
+	while (pos < end && *pos == ' ')
+		++pos;
+	return pos;
 }
 
-reciveMessage Parser::privateMessage(std::string message)
+static const char *findSpace(const char *pos, const char *end)
 {
-	reciveMessage info;
-
-	std::vector<std::string> words = split(message);
-	if (words.size() < 3)
-	{
-		info.target = "";
-		info.message = "";
-		return info;
-	}
-
-	info.target = words[1];
-
-	if (words[2][0] == ':')
-		words[2].erase(0, 1);
-
-	for (size_t i = 2; i < words.size(); i++)
-	{
-		info.message += trim(words[i]);
-		if (i != words.size() - 1)
-			info.message += " ";
-	}
-
-	return info;
+	const char *space = static_cast<const char *>(std::memchr(pos, ' ', end - pos));
+	return space == NULL ? end : space;
 }
 
-parseInfo Parser::parse(std::string message)
+// Splits "[@tags] [:prefix] command params... [:trailing]" in one pass. The
+// fifteenth parameter takes the rest of the line, as RFC 1459 allows it to
+// omit the ':'. Returns false when there is no command.
+bool Parser::parse(const char *data, size_t size, ircMessage& out)
 {
-	parseInfo info;
+	const char *pos = data;
+	const char *end = data + size;
+	const char *next;
 
-	if (message.find(" ") == std::string::npos)
-	{
-		info.command = message;
-		return info;
-	}
-
-	std::vector<std::string> words = split(message);
-
-	info.command = trim(words[0]);
-	if (words.size() == 1)
-		return info;
-
-	info.function = trim(words[1]);
-	if (words.size() == 2)
-	{
-		info.value = "";
-		return info;
-	}
+	out.tags = makeView(pos, 0);
+	out.prefix = makeView(pos, 0);
+	out.trailing = makeView(end, 0);
+	out.paramCount = 0;
+	out.hasTrailing = false;
 
-	for (size_t i = 2; i < words.size(); i++)
+	if (pos < end && *pos == '@')
 	{
-		info.value += trim(words[i]);
-		if (i != words.size() - 1)
-			info.value += " ";
+		next = findSpace(pos, end);
+		out.tags = makeView(pos + 1, next - pos - 1);
+		pos = skipSpaces(next, end);
 	}
-
-	return info;
-}
-
-userInfo Parser::userParse(std::string message)
-{
-	userInfo user;
-	std::string realName;
-
-	std::vector<std::string> words = split(message);
-	if (words.size() < 5 || words[4][0] != ':')
+	if (pos < end && *pos == ':')
 	{
-		user.userName = "";
-		user.realName = "";
-		return user;
+		next = findSpace(pos, end);
+		out.prefix = makeView(pos + 1, next - pos - 1);
+		pos = skipSpaces(next, end);
 	}
 
-	user.userName = words[1];
-	realName = words[4].replace(0, 1, "");
+	next = findSpace(pos, end);
+	out.command = makeView(pos, next - pos);
+	if (out.command.size == 0)
+		return false;
+	pos = skipSpaces(next, end);
 
-	if (words.size() == 5)
-		user.realName = realName;
-	else
+	while (pos < end)
 	{
-		for (size_t i = 5; i < words.size(); i++)
-			realName += " " + words[i];
-		user.realName = realName;
+		if (*pos == ':' || out.paramCount == ircMessage::MAX_PARAMS - 1)
+		{
+			if (*pos == ':')
+				++pos;
+			out.trailing = makeView(pos, end - pos);
+			out.hasTrailing = true;
+			out.params[out.paramCount++] = out.trailing;
+			break;
+		}
+		next = findSpace(pos, end);
+		out.params[out.paramCount++] = makeView(pos, next - pos);
+		pos = skipSpaces(next, end);
 	}
-
-	return user;
+	return true;
 }
 
-modeInfo Parser::modeParse(std::string message)
+std::string toString(const lineView& view)
 {
-	modeInfo info;
-
-	std::vector<std::string> words = split(message);
-	if (words.size() < 2)
-	{
-		info.channel = "";
-		info.status = false;
-		info.key = "";
-		info.parameters = "";
-		return info;
-	}
-	if (words.size() == 2)
-	{
-		info.channel = trim(words[1]);
-		info.status = false;
-		info.key = "";
-		info.parameters = "";
-		return info;
-	}
-
-	if (words.size() < 3)
-	{
-		info.channel = "";
-		info.status = false;
-		info.key = "";
-		info.parameters = "";
-		return info;
-	}
-
-	info.channel = trim(words[1]);
-	info.status = words[2][0] == '+';
-	info.key = words[2][1];
-
-	if (words.size() == 3) 
-		return info;
+	return std::string(view.data, view.size);
+}
 
-	info.parameters = trim(words[3]);
-	if (words.size() == 4)
-		return info;
+bool equals(const lineView& view, const char *str)
+{
+	return std::strlen(str) == view.size && std::memcmp(view.data, str, view.size) == 0;
+}
 
-	if (words.size() == 5)
-		info.parameters += trim(words[4]);
+bool equals(const lineView& view, const std::string& str)
+{
+	return str.size() == view.size && std::memcmp(view.data, str.data(), view.size) == 0;
+}
 
-	return info;
+// Steps through a comma separated list such as "#a,#b,#c", yielding one
+// item per call and an empty item for ",,". pos starts at 0.
+bool nextItem(const lineView& list, size_t& pos, lineView& item)
+{
+	if (pos > list.size)
+		return false;
+	const char *start = list.data + pos;
+	const char *comma = static_cast<const char *>(std::memchr(start, ',', list.size - pos));
+	size_t len = comma != NULL ? static_cast<size_t>(comma - start) : list.size - pos;
+	item = makeView(start, len);
+	pos += len + 1;
+	return true;
 }
@@ -0,0 +1,213 @@
+#include "Reactor.hpp"
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+
+#define RED "\033[1;31m"
+#define RESET "\033[0m"
+
+Reactor::~Reactor()
+{
+
+}
+
+Reactor *Reactor::create(const std::string& backend)
+{
+	if (backend == "poll")
+		return new PollReactor();
+#ifdef __linux__
+	if (backend == "epoll")
+		return new EpollReactor();
+#endif
+	throw std::invalid_argument(RED"Unsupported event backend: " + backend + RESET);
+}
+
+PollReactor::PollReactor()
+{
+
+}
+
+PollReactor::~PollReactor()
+{
+	fds.clear();
+	data.clear();
+	slots.clear();
+}
+
+static short toPollEvents(int events)
+{
+	short mask = 0;
+
+	if (events & Reactor::READ)
+		mask |= POLLIN;
+	if (events & Reactor::WRITE)
+		mask |= POLLOUT;
+	return mask;
+}
+
+void PollReactor::add(int fd, int events, void *ptr)
+{
+	if (fd < 0)
+		return;
+	if (static_cast<size_t>(fd) >= slots.size())
+		slots.resize(fd + 1, -1);
+	if (slots[fd] != -1)
+	{
+		modify(fd, events, ptr);
+		return;
+	}
+
+	struct pollfd entry;
+	entry.fd = fd;
+	entry.events = toPollEvents(events);
+	entry.revents = 0;
+	slots[fd] = fds.size();
+	fds.push_back(entry);
+	data.push_back(ptr);
+}
+
+void PollReactor::modify(int fd, int events, void *ptr)
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= slots.size() || slots[fd] == -1)
+		return;
+	fds[slots[fd]].events = toPollEvents(events);
+	data[slots[fd]] = ptr;
+}
+
+void PollReactor::remove(int fd)
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= slots.size() || slots[fd] == -1)
+		return;
+
+	size_t slot = slots[fd];
+	size_t last = fds.size() - 1;
+	if (slot != last)
+	{
+		fds[slot] = fds[last];
+		data[slot] = data[last];
+		slots[fds[slot].fd] = slot;
+	}
+	fds.pop_back();
+	data.pop_back();
+	slots[fd] = -1;
+}
+
+int PollReactor::wait(std::vector<reactorEvent>& out, int timeout)
+{
+	out.clear();
+	int ready = poll(fds.data(), fds.size(), timeout);
+	if (ready == -1)
+	{
+		if (errno == EINTR)
+			return 0;
+		throw std::runtime_error(RED"Error during poll: " + std::string(strerror(errno)) + RESET);
+	}
+
+	for (size_t i = 0; i < fds.size() && ready > 0; ++i)
+	{
+		if (fds[i].revents == 0)
+			continue;
+
+		reactorEvent ev;
+		ev.fd = fds[i].fd;
+		ev.data = data[i];
+		ev.readable = fds[i].revents & POLLIN;
+		ev.writable = fds[i].revents & POLLOUT;
+		ev.hangup = fds[i].revents & (POLLHUP | POLLERR | POLLNVAL);
+		out.push_back(ev);
+		ready--;
+	}
+	return out.size();
+}
+
+std::string PollReactor::getName() const
+{
+	return "poll";
+}
+
+#ifdef __linux__
+
+EpollReactor::EpollReactor() : events(256)
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1)
+		throw std::runtime_error(RED"Error: epoll_create1 failed " + std::string(strerror(errno)) + RESET);
+}
+
+EpollReactor::~EpollReactor()
+{
+	close(epfd);
+	events.clear();
+}
+
+static uint32_t toEpollEvents(int events)
+{
+	uint32_t mask = 0;
+
+	if (events & Reactor::READ)
+		mask |= EPOLLIN;
+	if (events & Reactor::WRITE)
+		mask |= EPOLLOUT;
+	if (events & Reactor::EDGE)
+		mask |= EPOLLET;
+	return mask;
+}
+
+void EpollReactor::add(int fd, int events, void *ptr)
+{
+	struct epoll_event ev;
+	ev.events = toEpollEvents(events);
+	ev.data.u64 = 0;
+	ev.data.ptr = ptr;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		throw std::runtime_error(RED"Error: epoll_ctl add failed " + std::string(strerror(errno)) + RESET);
+}
+
+void EpollReactor::modify(int fd, int events, void *ptr)
+{
+	struct epoll_event ev;
+	ev.events = toEpollEvents(events);
+	ev.data.u64 = 0;
+	ev.data.ptr = ptr;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1)
+		throw std::runtime_error(RED"Error: epoll_ctl mod failed " + std::string(strerror(errno)) + RESET);
+}
+
+void EpollReactor::remove(int fd)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int EpollReactor::wait(std::vector<reactorEvent>& out, int timeout)
+{
+	out.clear();
+	int ready = epoll_wait(epfd, events.data(), events.size(), timeout);
+	if (ready == -1)
+	{
+		if (errno == EINTR)
+			return 0;
+		throw std::runtime_error(RED"Error during epoll_wait: " + std::string(strerror(errno)) + RESET);
+	}
+
+	for (int i = 0; i < ready; ++i)
+	{
+		reactorEvent ev;
+		ev.fd = -1;
+		ev.data = events[i].data.ptr;
+		ev.readable = events[i].events & EPOLLIN;
+		ev.writable = events[i].events & EPOLLOUT;
+		ev.hangup = events[i].events & (EPOLLHUP | EPOLLERR);
+		out.push_back(ev);
+	}
+	if (static_cast<size_t>(ready) == events.size())
+		events.resize(events.size() * 2);
+	return ready;
+}
+
+std::string EpollReactor::getName() const
+{
+	return "epoll";
+}
+
+#endif
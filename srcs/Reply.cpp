@@ -0,0 +1,218 @@
+#include "Reply.hpp"
+#include <cstring>
+
+struct replyTemplate
+{
+	int			code;
+	const char	*text;
+};
+
+// Closing text of each numeric, sorted by code. NULL marks replies whose
+// last parameter is data supplied by the caller rather than fixed text.
+static const replyTemplate templates[] =
+{
+	{ Reply::RPL_WELCOME, "Welcome to the Internet Relay Network" },
+	{ Reply::RPL_STATSCOMMANDS, NULL },
+	{ Reply::RPL_ENDOFSTATS, "End of STATS report" },
+	{ Reply::RPL_STATSUPTIME, NULL },
+	{ Reply::RPL_STATSDEBUG, NULL },
+	{ Reply::RPL_CHANNELMODEIS, NULL },
+	{ Reply::RPL_TOPIC, NULL },
+	{ Reply::RPL_TOPICWHOTIME, NULL },
+	{ Reply::RPL_INVITING, NULL },
+	{ Reply::RPL_NAMREPLY, NULL },
+	{ Reply::RPL_ENDOFNAMES, "End of /NAMES list." },
+	{ Reply::RPL_YOUREOPER, "You are now an IRC operator" },
+	{ Reply::ERR_NOSUCHNICK, "No such nick/channel" },
+	{ Reply::ERR_NOSUCHCHANNEL, "No such channel" },
+	{ Reply::ERR_NORECIPIENT, "No recipient given (PRIVMSG)" },
+	{ Reply::ERR_UNKNOWNCOMMAND, "Unknown command" },
+	{ Reply::ERR_NONICKNAMEGIVEN, "No nickname given" },
+	{ Reply::ERR_ERRONEUSNICKNAME, "Erroneous nickname" },
+	{ Reply::ERR_NICKNAMEINUSE, "Nickname is already in use" },
+	{ Reply::ERR_USERNOTINCHANNEL, "They aren't on that channel" },
+	{ Reply::ERR_NOTONCHANNEL, "You're not on that channel" },
+	{ Reply::ERR_USERONCHANNEL, "is already on channel" },
+	{ Reply::ERR_NOTREGISTERED, "You have not registered" },
+	{ Reply::ERR_NEEDMOREPARAMS, "Not enough parameters" },
+	{ Reply::ERR_ALREADYREGISTRED, "You may not reregister" },
+	{ Reply::ERR_PASSWDMISMATCH, "Password incorrect" },
+	{ Reply::ERR_CHANNELISFULL, "Cannot join channel (+l)" },
+	{ Reply::ERR_UNKNOWNMODE, "is unknown mode char to me" },
+	{ Reply::ERR_INVITEONLYCHAN, "Cannot join channel (+i)" },
+	{ Reply::ERR_BADCHANNELKEY, "Cannot join channel (+k)" },
+	{ Reply::ERR_NOPRIVILEGES, "Permission Denied- You're not an IRC operator" },
+	{ Reply::ERR_CHANOPRIVSNEEDED, "You're not channel operator" },
+	{ Reply::ERR_NOOPERHOST, "No O-lines for your host" },
+	{ Reply::ERR_INVALIDMODEPARAM, "Invalid mode parameter" }
+};
+
+Reply::Reply(std::string& out, const std::string& serverName) : out(out), serverName(serverName), closing(NULL)
+{
+
+}
+
+const char *Reply::text(replyCode code)
+{
+	size_t low = 0;
+	size_t high = sizeof(templates) / sizeof(templates[0]);
+
+	while (low < high)
+	{
+		size_t mid = (low + high) / 2;
+		if (templates[mid].code < code)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low < sizeof(templates) / sizeof(templates[0]) && templates[low].code == code)
+		return templates[low].text;
+	return NULL;
+}
+
+// Writes the decimal form of value through a stack buffer instead of a
+// stringstream.
+void Reply::appendNumber(std::string& out, long value)
+{
+	char digits[24];
+	size_t pos = sizeof(digits);
+	unsigned long magnitude = value < 0 ? 0UL - static_cast<unsigned long>(value) : static_cast<unsigned long>(value);
+
+	do
+	{
+		digits[--pos] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude != 0);
+	if (value < 0)
+		digits[--pos] = '-';
+	out.append(digits + pos, sizeof(digits) - pos);
+}
+
+// ":<server> <code> <target>", with "*" standing in for a client that has
+// no nickname yet.
+Reply& Reply::numeric(replyCode code, const std::string& target)
+{
+	char digits[3];
+
+	digits[0] = '0' + code / 100;
+	digits[1] = '0' + code / 10 % 10;
+	digits[2] = '0' + code % 10;
+	out.assign(1, ':');
+	out.append(serverName).append(1, ' ').append(digits, 3).append(1, ' ');
+	if (target.empty())
+		out.append(1, '*');
+	else
+		out.append(target);
+	closing = text(code);
+	return *this;
+}
+
+// A command sent by the server itself.
+Reply& Reply::command(const char *command)
+{
+	return this->command(serverName, command);
+}
+
+Reply& Reply::command(const std::string& source, const char *command)
+{
+	out.assign(1, ':');
+	out.append(source).append(1, ' ').append(command);
+	closing = NULL;
+	return *this;
+}
+
+// A NOTICE from the server, addressed like a numeric.
+Reply& Reply::notice(const std::string& target)
+{
+	command("NOTICE");
+	return target.empty() ? param("*", 1) : param(target);
+}
+
+Reply& Reply::param(const std::string& value)
+{
+	return param(value.data(), value.size());
+}
+
+Reply& Reply::param(const char *value)
+{
+	return param(value, std::strlen(value));
+}
+
+Reply& Reply::param(const char *value, size_t len)
+{
+	out.append(1, ' ').append(value, len);
+	return *this;
+}
+
+Reply& Reply::param(long value)
+{
+	out.append(1, ' ');
+	appendNumber(out, value);
+	return *this;
+}
+
+// Opens the last parameter; anything appended afterwards belongs to it.
+Reply& Reply::trailing()
+{
+	out.append(" :", 2);
+	closing = NULL;
+	return *this;
+}
+
+Reply& Reply::trailing(const std::string& text)
+{
+	return trailing(text.data(), text.size());
+}
+
+Reply& Reply::trailing(const char *text)
+{
+	return trailing(text, std::strlen(text));
+}
+
+Reply& Reply::trailing(const char *text, size_t len)
+{
+	trailing();
+	out.append(text, len);
+	return *this;
+}
+
+Reply& Reply::append(const std::string& text)
+{
+	out.append(text);
+	return *this;
+}
+
+Reply& Reply::append(const char *text)
+{
+	out.append(text);
+	return *this;
+}
+
+Reply& Reply::append(const char *text, size_t len)
+{
+	out.append(text, len);
+	return *this;
+}
+
+Reply& Reply::append(char c)
+{
+	out.append(1, c);
+	return *this;
+}
+
+// Adds the numeric's closing text unless the caller supplied its own, then
+// terminates the line.
+const std::string& Reply::end()
+{
+	if (closing != NULL)
+		trailing(closing);
+	if (out.size() > LINE_LIMIT - 2)
+		out.resize(LINE_LIMIT - 2);
+	out.append("\r\n", 2);
+	return out;
+}
+
+const std::string& Reply::getServerName() const
+{
+	return serverName;
+}
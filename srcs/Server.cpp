@@ -1,122 +1,235 @@
 #include "Server.hpp"
+#include <signal.h>
+#include <sys/resource.h>
 
-Server::Server(const std::string& port, const std::string& pwd)
+// Lifts the soft descriptor limit to the hard limit so the server is bounded
+// by what the administrator allows rather than the conservative default.
+static void raiseFdLimit(Logger& logger)
 {
-	if (!checkPort(port))
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == limit.rlim_max)
+		return;
+	limit.rlim_cur = limit.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+		logger.log(Logger::WARN, Logger::SERVER, "could not raise the file descriptor limit: %s", strerror(errno));
+}
+
+int Server::pendingSignal = 0;
+int Server::signalWakeFd = -1;
+
+Server::Server(const serverConfig& config)
+	: logger(config), metrics(config.threads), tracer(config, logger), metricsEndpoint(NULL), capture(NULL), commands(NULL), activeShard(NULL), nextClientId(0), stopping(0)
+{
+	if (!checkPort(config.port))
 		throw std::invalid_argument(RED"Invalid port.\n" GREEN"Usage: " WHITE"\"./ft_irc\" \"0 < port < 65536\" \"password\"" RESET);
-	this->pwd = pwd;
-	initServer(port);
+	this->pwd = config.pwd;
+	raiseFdLimit(logger);
+	pthread_mutex_init(&stateLock, NULL);
+	commands = makeCommands(config);
+
+	try
+	{
+		for (int i = 0; i < config.threads; i++)
+			shards.push_back(new Shard(*this, i, config));
+		if (!config.metricsSocket.empty())
+			metricsEndpoint = new MetricsEndpoint(metrics, logger, config.metricsSocket);
+		if (!config.captureFile.empty())
+			capture = new Capture(logger, config.captureFile);
+	}
+	catch (...)
+	{
+		delete metricsEndpoint;
+		destroyShards();
+		delete commands;
+		pthread_mutex_destroy(&stateLock);
+		throw;
+	}
+
+	logger.log(Logger::INFO, Logger::SERVER, "Server is running on port %s (%s, %d thread%s)",
+		config.port.c_str(), config.backend.c_str(), config.threads, config.threads > 1 ? "s" : "");
+	if (metricsEndpoint != NULL)
+		logger.log(Logger::INFO, Logger::SERVER, "Metrics are served on %s", config.metricsSocket.c_str());
+	if (capture != NULL)
+		logger.log(Logger::INFO, Logger::SERVER, "Client traffic is captured to %s", config.captureFile.c_str());
 }
 
 Server::~Server()
 {
-	for (std::map<int, Client>::const_iterator it = clients.begin(); it != clients.end(); ++it)
-		if (it->first != -1)
-			close(it->first);
-	close(server_fd);
-	clients.clear();
-	fds.clear();
+	stop("");
+	for (size_t i = 0; i < shards.size(); ++i)
+		shards[i]->join();
+	delete metricsEndpoint;
+	delete capture;
+	destroyShards();
+	for (int fd = 0; fd < clients.limit(); ++fd)
+		if (clients.find(fd) != NULL)
+			close(fd);
+	delete commands;
 	channels.clear();
+	pthread_mutex_destroy(&stateLock);
 }
 
+void Server::destroyShards()
+{
+	for (size_t i = 0; i < shards.size(); ++i)
+		delete shards[i];
+	shards.clear();
+}
+
+// Shard 0 runs on the calling thread, the others get their own. Termination
+// and trace signals stay on this thread, where notifySignal wakes shard 0.
 void Server::run()
 {
-	while (true)
+	sigset_t blocked, previous;
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGINT);
+	sigaddset(&blocked, SIGTERM);
+	sigaddset(&blocked, SIGQUIT);
+	sigaddset(&blocked, SIGUSR1);
+
+	pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+	try
 	{
-		int ready = poll(fds.data(), fds.size(), -1);
-
-		if (ready == -1)
-			throw std::runtime_error(RED"Error during poll: " + std::string(strerror(errno)) + RESET);
-
-		if (fds[0].revents & POLLIN)
-		{
-			int client_fd = accept(server_fd, NULL, NULL);
-			if (client_fd == -1)
-				throw std::runtime_error(RED"Error accepting new client: " + std::string(strerror(errno)) + RESET);
-
-			if (fcntl(client_fd, F_SETFL, O_NONBLOCK) == -1)
-				throw std::runtime_error(RED"Error setting non-blocking mode: " + std::string(strerror(errno)) + RESET);
-
-			clients.insert(std::make_pair(client_fd, Client(client_fd)));
-
-			struct pollfd client_pollfd;
-			client_pollfd.fd = client_fd;
-			client_pollfd.events = POLLIN;
-			fds.push_back(client_pollfd);
-	
-			std::cout << "New client connected: fd = " << client_fd << std::endl;
-			ready--;
-		}
-
-		for (size_t i = 1; i < fds.size() && ready > 0; ++i)
-		{
-			if (fds[i].revents & (POLLHUP | POLLERR))
-			{
-				std::cout << "Client error/disconnect: fd = " << fds[i].fd << std::endl;
-				std::map<int, Client>::iterator it = clients.find(fds[i].fd);
-				if (it != clients.end())
-				{
-					removeNick(it->second.getNickname());
-					std::string quit = "QUIT\r\n";
-					handleClientMessage(it->second, quit);
-					clients.erase(it);
-				}
-				if (fds[i].fd != -1)
-					close(fds[i].fd);
-				fds.erase(fds.begin() + i);
-				--i;
-				ready--;
-				continue;
-			}
-
-			if (fds[i].revents & POLLIN)
-			{
-				char buffer[1024];
-
-				ssize_t n;
-				while ((n = read(fds[i].fd, buffer, sizeof(buffer) - 1)) > 0)
-				{
-					buffer[n] = '\0';
-					std::map<int, Client>::iterator it = clients.find(fds[i].fd);
-					if (it == clients.end())
-					{
-						std::cerr << "Error: Client not found for fd " << fds[i].fd << std::endl;
-						break;
-					}
-					
-					Client& client = it->second;
-					client.appendToBuffer(buffer);
-					client.setPwd(pwd);
-
-					std::string message;
-					while (client.hasFullMessage(message))
-					{
-						handleClientMessage(client, message);
-						std::cout << "IRC message from {" << fds[i].fd << "} : [" << message << "]" << std::endl;
-					}
-				}
-				if (n == 0)
-				{
-					std::cout << "Client disconnected: fd = " << fds[i].fd << std::endl;
-					std::map<int, Client>::iterator it = clients.find(fds[i].fd);
-					if (it != clients.end())
-					{
-						removeNick(it->second.getNickname());
-						std::string quit = "QUIT\r\n";
-						handleClientMessage(it->second, quit);
-						clients.erase(it);
-					}
-					if (fds[i].fd != -1)
-						close(fds[i].fd);
-					fds.erase(fds.begin() + i);
-					--i;
-				}
-				else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-					throw std::runtime_error(RED"Error reading from client: " + std::string(strerror(errno)) + RESET);
-				ready--;
-			}
-		}
+		logger.start();
+		for (size_t i = 1; i < shards.size(); ++i)
+			shards[i]->start();
+		if (metricsEndpoint != NULL)
+			metricsEndpoint->start();
 	}
+	catch (...)
+	{
+		pthread_sigmask(SIG_SETMASK, &previous, NULL);
+		throw;
+	}
+	__atomic_store_n(&signalWakeFd, shards[0]->getWakeFd(), __ATOMIC_RELEASE);
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+	shards[0]->run();
+	__atomic_store_n(&signalWakeFd, -1, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&stateLock);
+	std::string reason = failure;
+	pthread_mutex_unlock(&stateLock);
+	if (!reason.empty())
+		throw std::runtime_error(reason);
+}
+
+// Asks every event loop to return. The first non-empty reason is what run()
+// reports once shard 0 notices.
+void Server::stop(const std::string& reason)
+{
+	if (!reason.empty())
+	{
+		pthread_mutex_lock(&stateLock);
+		if (failure.empty())
+			failure = reason;
+		pthread_mutex_unlock(&stateLock);
+	}
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	for (size_t i = 0; i < shards.size(); ++i)
+		shards[i]->wake();
+}
+
+bool Server::isStopping() const
+{
+	return __atomic_load_n(&stopping, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Only async-signal-safe work here: a flag and a byte down shard 0's wake
+// pipe. The loops act on it in checkSignals, outside any lock or syscall.
+void Server::notifySignal(int signal)
+{
+	if (signal == SIGUSR1)
+		Tracer::requestDump();
+	else
+		__atomic_store_n(&pendingSignal, signal, __ATOMIC_RELEASE);
+
+	int fd = __atomic_load_n(&signalWakeFd, __ATOMIC_ACQUIRE);
+	if (fd != -1)
+	{
+		int saved = errno;
+		char c = 1;
+		ssize_t written = write(fd, &c, 1);
+		(void)written;
+		errno = saved;
+	}
+}
+
+void Server::checkSignals()
+{
+	if (__atomic_load_n(&pendingSignal, __ATOMIC_ACQUIRE) == 0)
+		return;
+	int signal = __atomic_exchange_n(&pendingSignal, 0, __ATOMIC_ACQ_REL);
+	if (signal != 0)
+		stop(RED"Server terminated by signal " + ft_itoa(signal) + RESET);
+}
+
+// Everything below the state lock (clients, channels, nicks and the
+// protocol fields of each Client) is shared between shards, and every
+// command runs under it, so commands are serialized across shards. Taking the lock
+// also flushes the caller's inbox so cross-shard output queued before this
+// point is delivered ahead of anything the caller produces now.
+void Server::lockState(Shard *shard)
+{
+	pthread_mutex_lock(&stateLock);
+	activeShard = shard;
+	if (shard != NULL)
+		shard->drainInbox();
+}
+
+void Server::unlockState()
+{
+	activeShard = NULL;
+	pthread_mutex_unlock(&stateLock);
+}
+
+Client *Server::registerClient(int fd, int shard)
+{
+	Client *client = clients.insert(fd);
+	client->setPwd(pwd);
+	client->setId(++nextClientId);
+	client->setShard(shard);
+	if (capture != NULL)
+		capture->connected(client->getId());
+	metrics.setGauge(Metrics::CLIENTS, clients.size());
+	return client;
+}
+
+void Server::unregisterClient(Client& client)
+{
+	if (capture != NULL)
+		capture->disconnected(client.getId());
+	removeNick(client);
+	handleClientMessage(client, "QUIT");
+	clients.erase(client.getFd());
+	metrics.setGauge(Metrics::CLIENTS, clients.size());
+}
+
+void Server::queueMessage(int fd, const std::string& msg)
+{
+	if (fd >= 0)
+		queueMessage(fd, MessageBuffer(msg));
+}
+
+// Output is appended directly when the target belongs to the shard running
+// the current command, and posted to the owning shard's inbox otherwise.
+// Either way the recipient shares the caller's buffer rather than copying it.
+void Server::queueMessage(int fd, const MessageBuffer& msg)
+{
+	if (fd < 0)
+		return;
+
+	Client *target = clients.find(fd);
+	if (target == NULL)
+		return;
+
+	Client& client = *target;
+	Shard *owner = shards[client.getShard()];
+	if (owner == activeShard)
+		owner->deliver(client, msg);
+	else
+		owner->post(fd, client.getId(), msg);
 }
 
 bool Server::checkPort(const std::string& port)
@@ -133,72 +246,122 @@ bool Server::checkPort(const std::string& port)
 	return (true);
 }
 
-void Server::handleClientMessage(Client& client, std::string& msg)
+void Server::handleClientMessage(Client& client, const lineView& line)
 {
-	std::string &buffer = msg;
+	ircMessage msg;
+	bool valid = Parser::parse(line.data, line.size, msg);
+	dispatchMessage(client, valid ? &msg : NULL, line.size);
+}
 
-	size_t pos;
-	while ((pos = buffer.find("\r\n")) != std::string::npos)
-	{
-		std::string line = buffer.substr(0, pos);
-		buffer.erase(pos, pos + 2);
-		Commands commands(clients, channels, *this);
-		commands.executeCommand(line, client);
-	}
+// Runs a line its shard parsed before taking the state lock; msg is NULL
+// for a line without a command. Commands themselves stay serialized.
+void Server::dispatchMessage(Client& client, const ircMessage *msg, size_t size)
+{
+	metrics.add(Metrics::LINES_PARSED, 1);
+	if (msg != NULL)
+		commands->executeCommand(*msg, size, client);
 }
 
-void Server::initServer(const std::string& port)
+void Server::handleClientMessage(Client& client, const std::string& line)
 {
-	int opt;
-	struct sockaddr_in address;
+	lineView view;
+	view.data = line.data();
+	view.size = line.size();
+	handleClientMessage(client, view);
+}
 
-	server_fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (server_fd == -1)
-		throw std::runtime_error(RED"Error: socket creation failed " + std::string(strerror(errno)) + RESET);
+// A dispatcher over this server's state. The server keeps one for its
+// lifetime; bench/DispatchBench also builds one per line to measure what
+// that saves.
+Commands *Server::makeCommands(const serverConfig& config)
+{
+	return new Commands(clients, channels, names, config, *this);
+}
 
-	opt = 1;
-	if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-	{
-		close(server_fd);
-		throw std::runtime_error(RED"Error: setsockopt failed " + std::string(strerror(errno)) + RESET);
-	}
+Shard& Server::getShard(int id)
+{
+	return *shards[id];
+}
 
-	address.sin_family = AF_INET;
-	address.sin_addr.s_addr = INADDR_ANY;
-	address.sin_port = htons(std::strtol(port.c_str(), NULL, 10));
+Metrics& Server::getMetrics()
+{
+	return metrics;
+}
+
+Logger& Server::getLogger()
+{
+	return logger;
+}
+
+Tracer& Server::getTracer()
+{
+	return tracer;
+}
+
+Capture *Server::getCapture()
+{
+	return capture;
+}
 
-	if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+// Starts a trace dump with the state lock held; result describes it for a
+// reply. The file itself is written and logged by the tracer's own thread.
+bool Server::dumpTrace(std::string& result)
+{
+	if (!tracer.dump(result))
 	{
-		close(server_fd);	
-		throw std::runtime_error(RED"Error: bind failed " + std::string(strerror(errno)) + RESET);
+		logger.log(Logger::WARN, Logger::SERVER, "trace dump failed: %s", result.c_str());
+		return false;
 	}
+	return true;
+}
 
-	if (listen(server_fd, 10) < 0)
+// The nick index maps the interned id of every registered nickname straight
+// to its client, which stays put until it is unregistered. Services that
+// have no socket are registered here too. It is only touched with the state
+// lock held.
+//
+// Gives client the nickname unless someone else holds it under RFC 1459
+// casemapping. Changing only the case of one's own nick keeps the same id.
+bool Server::setNick(Client& client, const std::string& nick)
+{
+	nameId id = names.acquire(nick);
+	std::pair<std::tr1::unordered_map<nameId, Client *>::iterator, bool> slot = nicks.insert(std::make_pair(id, &client));
+	if (!slot.second && slot.first->second != &client)
 	{
-		close(server_fd);
-		throw std::runtime_error(RED"Error: listen failed " + std::string(strerror(errno)) + RESET);
+		names.release(id);
+		return false;
 	}
 
-	std::cout << BLUE"Server is running on port " << port << RESET << std::endl;
-
-	struct pollfd server_pollfd;
-	server_pollfd.fd = server_fd;
-	server_pollfd.events = POLLIN;
-	fds.push_back(server_pollfd);
+	if (client.getNickId() == id)
+		names.release(id);
+	else
+		removeNick(client);
+	client.setNickname(nick);
+	client.setNickId(id);
+	return true;
 }
 
-bool Server::addNick(std::string& nick)
+// Only drops the entry if it still belongs to client, so a stale removal
+// cannot take a nickname away from whoever registered it since.
+void Server::removeNick(Client& client)
 {
-	if (std::find(nickList.begin(), nickList.end(), nick) != nickList.end())
-		return false;
+	nameId id = client.getNickId();
+	if (id == NameTable::NONE)
+		return;
 
-	nickList.push_back(nick);
-	return true;
+	std::tr1::unordered_map<nameId, Client *>::iterator it = nicks.find(id);
+	if (it != nicks.end() && it->second == &client)
+		nicks.erase(it);
+	names.release(id);
+	client.setNickId(NameTable::NONE);
 }
 
-void Server::removeNick(std::string nick)
+Client *Server::findClient(const std::string& nick)
 {
-	std::vector<std::string>::iterator it = std::find(nickList.begin(), nickList.end(), nick);
-	if (it != nickList.end())
-		nickList.erase(it);
+	nameId id = names.find(nick);
+	if (id == NameTable::NONE)
+		return NULL;
+
+	std::tr1::unordered_map<nameId, Client *>::const_iterator it = nicks.find(id);
+	return it == nicks.end() ? NULL : it->second;
 }
@@ -0,0 +1,21 @@
+#include "Service.hpp"
+
+ServiceHost::~ServiceHost()
+{
+
+}
+
+Service::Service(int fd) : client(fd)
+{
+
+}
+
+Service::~Service()
+{
+
+}
+
+Client& Service::getClient()
+{
+	return client;
+}
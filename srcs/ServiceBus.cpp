@@ -0,0 +1,80 @@
+#include "ServiceBus.hpp"
+
+ServiceBus::ServiceBus() : subscribed(0)
+{
+
+}
+
+ServiceBus::~ServiceBus()
+{
+	for (size_t i = 0; i < services.size(); ++i)
+		delete services[i];
+}
+
+// Takes ownership of service.
+void ServiceBus::add(Service *service)
+{
+	services.push_back(service);
+	subscribed |= service->subscriptions();
+}
+
+// Services that fail to start (their nickname is taken, say) are dropped.
+void ServiceBus::start(ServiceHost& host)
+{
+	subscribed = 0;
+	for (size_t i = 0; i < services.size(); )
+	{
+		if (services[i]->start(host))
+		{
+			subscribed |= services[i]->subscriptions();
+			++i;
+			continue;
+		}
+		delete services[i];
+		services.erase(services.begin() + i);
+	}
+}
+
+bool ServiceBus::wants(serviceEvent::kind type) const
+{
+	return (subscribed & type) != 0;
+}
+
+void ServiceBus::publish(serviceEvent::kind type, const Client& client, nameId channel, const std::string& text)
+{
+	if (!wants(type))
+		return;
+
+	pending.push_back(serviceEvent());
+	serviceEvent& event = pending.back();
+	event.type = type;
+	event.fd = client.getFd();
+	event.clientId = client.getId();
+	event.channel = channel;
+	event.text = text;
+}
+
+// Runs after the command that queued the events. Whatever services do in
+// response goes through the host and is not reported back to them, but
+// events queued meanwhile are still handled before returning.
+void ServiceBus::dispatch(ServiceHost& host)
+{
+	while (!pending.empty())
+	{
+		running.swap(pending);
+		for (size_t i = 0; i < running.size(); ++i)
+			for (size_t j = 0; j < services.size(); ++j)
+				if (services[j]->subscriptions() & running[i].type)
+					services[j]->handle(running[i], host);
+		running.clear();
+	}
+}
+
+// The client behind a channel member flagged as a service.
+Client *ServiceBus::findClient(int fd)
+{
+	for (size_t i = 0; i < services.size(); ++i)
+		if (services[i]->getClient().getFd() == fd)
+			return &services[i]->getClient();
+	return NULL;
+}
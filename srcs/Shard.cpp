@@ -0,0 +1,618 @@
+#include "Shard.hpp"
+#include "Server.hpp"
+#include <netinet/tcp.h>
+
+#ifdef __linux__
+// Submission queue depth, and the number and size of the provided buffers
+// that multishot recv fills, per shard.
+static const unsigned URING_ENTRIES = 256;
+static const unsigned URING_BUFFERS = 1024;
+static const unsigned URING_BUFFER_SIZE = 4096;
+#endif
+
+// Holds the shared state lock for the lifetime of a scope, so an exception
+// unwinding out of a command handler cannot leave the other shards blocked.
+class StateGuard
+{
+	private:
+			Server	&server;
+
+			StateGuard(const StateGuard&);
+			StateGuard& operator=(const StateGuard&);
+
+	public:
+			StateGuard(Server& server, Shard *shard) : server(server)
+			{
+				server.lockState(shard);
+			}
+
+			~StateGuard()
+			{
+				server.unlockState();
+			}
+};
+
+Shard::Shard(Server& server, int id, const serverConfig& config)
+	: server(server), metrics(server.getMetrics()), logger(server.getLogger()), tracer(server.getTracer()), id(id), listen_fd(-1), reserved_fd(-1), acceptBudget(config.acceptBudget), wakePending(0),
+	reactor(NULL),
+#ifdef __linux__
+	uring(NULL),
+#endif
+	sendqLimit(config.sendqLimit), threadStarted(false)
+{
+	wakeFds[0] = -1;
+	wakeFds[1] = -1;
+	try
+	{
+#ifdef __linux__
+		if (config.backend == "uring")
+			uring = new Uring(URING_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE);
+		else
+#endif
+			reactor = Reactor::create(config.backend);
+
+		if (pipe(wakeFds) == -1)
+			throw std::runtime_error(RED"Error: pipe creation failed " + std::string(strerror(errno)) + RESET);
+		if (fcntl(wakeFds[0], F_SETFL, O_NONBLOCK) == -1 || fcntl(wakeFds[1], F_SETFL, O_NONBLOCK) == -1)
+			throw std::runtime_error(RED"Error setting non-blocking mode: " + std::string(strerror(errno)) + RESET);
+		if (reactor != NULL)
+			reactor->add(wakeFds[0], Reactor::READ, wakeFds);
+
+		openListener(config);
+		reserveFd();
+	}
+	catch (...)
+	{
+		if (listen_fd != -1)
+			close(listen_fd);
+		if (wakeFds[0] != -1)
+			close(wakeFds[0]);
+		if (wakeFds[1] != -1)
+			close(wakeFds[1]);
+		delete reactor;
+#ifdef __linux__
+		delete uring;
+#endif
+		throw;
+	}
+}
+
+Shard::~Shard()
+{
+	if (listen_fd != -1)
+		close(listen_fd);
+	if (reserved_fd != -1)
+		close(reserved_fd);
+	close(wakeFds[0]);
+	close(wakeFds[1]);
+	delete reactor;
+#ifdef __linux__
+	delete uring;
+	slots.clear();
+#endif
+	local.clear();
+}
+
+int Shard::getId() const
+{
+	return (this->id);
+}
+
+void Shard::openListener(const serverConfig& config)
+{
+	int opt;
+	struct sockaddr_in address;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd == -1)
+		throw std::runtime_error(RED"Error: socket creation failed " + std::string(strerror(errno)) + RESET);
+
+	opt = 1;
+	if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+	{
+		close(listen_fd);
+		listen_fd = -1;
+		throw std::runtime_error(RED"Error: setsockopt failed " + std::string(strerror(errno)) + RESET);
+	}
+
+	if (config.threads > 1)
+	{
+#ifdef SO_REUSEPORT
+		if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+#endif
+		{
+			close(listen_fd);
+			listen_fd = -1;
+			throw std::runtime_error(RED"Error: SO_REUSEPORT is not available " + std::string(strerror(errno)) + RESET);
+		}
+	}
+
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = htons(std::strtol(config.port.c_str(), NULL, 10));
+
+	if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+	{
+		close(listen_fd);
+		listen_fd = -1;
+		throw std::runtime_error(RED"Error: bind failed " + std::string(strerror(errno)) + RESET);
+	}
+
+	if (listen(listen_fd, config.backlog) < 0)
+	{
+		close(listen_fd);
+		listen_fd = -1;
+		throw std::runtime_error(RED"Error: listen failed " + std::string(strerror(errno)) + RESET);
+	}
+
+	if (fcntl(listen_fd, F_SETFL, O_NONBLOCK) == -1)
+	{
+		close(listen_fd);
+		listen_fd = -1;
+		throw std::runtime_error(RED"Error setting non-blocking mode: " + std::string(strerror(errno)) + RESET);
+	}
+
+	if (reactor != NULL)
+		reactor->add(listen_fd, Reactor::READ, &listen_fd);
+}
+
+void *Shard::threadMain(void *arg)
+{
+	Shard *shard = static_cast<Shard *>(arg);
+
+	try
+	{
+		shard->run();
+	}
+	catch (const std::exception& e)
+	{
+		shard->server.stop(e.what());
+	}
+	return NULL;
+}
+
+void Shard::start()
+{
+	if (pthread_create(&thread, NULL, &Shard::threadMain, this) != 0)
+		throw std::runtime_error(RED"Error: could not start event loop thread" RESET);
+	threadStarted = true;
+}
+
+void Shard::join()
+{
+	if (!threadStarted)
+		return;
+	pthread_join(thread, NULL);
+	threadStarted = false;
+}
+
+void Shard::wake()
+{
+	if (__atomic_exchange_n(&wakePending, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		char c = 1;
+		if (write(wakeFds[1], &c, 1) == -1 && errno != EAGAIN)
+			logger.log(Logger::ERROR, Logger::SERVER, "could not wake event loop %d: %s", id, strerror(errno));
+	}
+}
+
+int Shard::getWakeFd() const
+{
+	return wakeFds[1];
+}
+
+void Shard::handleWake()
+{
+	char drain[64];
+
+	while (read(wakeFds[0], drain, sizeof(drain)) > 0)
+		;
+	__atomic_store_n(&wakePending, 0, __ATOMIC_RELEASE);
+	drainInbox();
+}
+
+void Shard::run()
+{
+	server.checkSignals();
+#ifdef __linux__
+	if (uring != NULL)
+	{
+		runUring();
+		return;
+	}
+#endif
+	runReactor();
+}
+
+void Shard::runReactor()
+{
+	std::vector<reactorEvent> events;
+
+	while (!server.isStopping())
+	{
+		unsigned long long waited = tracer.enabled() ? Metrics::nowNs() : 0;
+		reactor->wait(events, -1);
+		unsigned long long start = Metrics::nowNs();
+
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			if (events[i].data == &listen_fd)
+			{
+				acceptClients();
+				continue;
+			}
+			if (events[i].data == wakeFds)
+			{
+				handleWake();
+				continue;
+			}
+
+			Client& client = *static_cast<Client *>(events[i].data);
+			if (client.isClosing())
+				continue;
+
+			if (events[i].writable)
+				flushClient(client);
+
+			if (events[i].readable && !readFromClient(client))
+				continue;
+
+			if (events[i].hangup)
+			{
+				logger.log(Logger::INFO, Logger::CONN, "Client error/disconnect: fd = %d", client.getFd());
+				disconnectClient(client);
+			}
+		}
+		unsigned long long flushed = tracer.enabled() ? Metrics::nowNs() : 0;
+		processPendingOutput();
+		endIteration(waited, start, flushed);
+	}
+}
+
+// Records the iteration that began at start, after waiting since waited,
+// with output flushed from flushed on, and serves a pending trace dump.
+void Shard::endIteration(unsigned long long waited, unsigned long long start, unsigned long long flushed)
+{
+	unsigned long long end = Metrics::nowNs();
+	metrics.observeLoop(id, end - start);
+	if (tracer.enabled())
+	{
+		tracer.record(id, "wait", waited, start);
+		tracer.record(id, "events", start, flushed);
+		tracer.record(id, "flush", flushed, end);
+	}
+	server.checkSignals();
+	if (Tracer::takeDumpRequest())
+	{
+		StateGuard guard(server, this);
+		std::string result;
+		server.dumpTrace(result);
+	}
+}
+
+Client *Shard::findLocal(int fd) const
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= local.size())
+		return NULL;
+	return local[fd];
+}
+
+// Keeps one descriptor in hand so that, when the process runs out, it can be
+// released to accept and immediately close the pending connection instead of
+// leaving it in the backlog where the listener would keep firing.
+void Shard::reserveFd()
+{
+	if (reserved_fd == -1)
+		reserved_fd = open("/dev/null", O_RDONLY);
+}
+
+void Shard::shedConnection()
+{
+	if (reserved_fd != -1)
+	{
+		close(reserved_fd);
+		reserved_fd = -1;
+	}
+
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd != -1)
+		close(fd);
+	reserveFd();
+	logger.log(Logger::WARN, Logger::CONN, "Out of file descriptors, dropped a new connection");
+}
+
+static int acceptNonBlocking(int listen_fd)
+{
+#ifdef __linux__
+	return accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd == -1)
+		return -1;
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+#endif
+}
+
+// Accepts at most acceptBudget connections per wakeup so a connect storm
+// cannot starve established clients. The listener is level-triggered, so
+// whatever is left in the backlog is picked up on the next iteration.
+void Shard::acceptClients()
+{
+	for (int accepted = 0; accepted < acceptBudget; accepted++)
+	{
+		int client_fd = acceptNonBlocking(listen_fd);
+		if (client_fd == -1)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if (errno == EMFILE || errno == ENFILE)
+			{
+				shedConnection();
+				continue;
+			}
+			if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+				continue;
+			logger.log(Logger::ERROR, Logger::CONN, "Error accepting new client: %s", strerror(errno));
+			return;
+		}
+
+		addClient(client_fd);
+	}
+}
+
+void Shard::addClient(int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	Client *client;
+	{
+		StateGuard guard(server, this);
+		client = server.registerClient(fd, id);
+	}
+	if (static_cast<size_t>(fd) >= local.size())
+		local.resize(fd + 1, NULL);
+	local[fd] = client;
+
+#ifdef __linux__
+	if (uring != NULL)
+	{
+		if (static_cast<size_t>(fd) >= slots.size())
+			slots.resize(fd + 1);
+		slots[fd] = uringSlot();
+		slots[fd].clientId = client->getId();
+		armRecv(*client);
+	}
+	else
+#endif
+		reactor->add(fd, Reactor::READ | Reactor::EDGE, client);
+
+	logger.log(Logger::INFO, Logger::CONN, "New client connected: fd = %d", fd);
+}
+
+// Drains the socket completely, as required by edge-triggered backends.
+// Returns false once the client has been disconnected.
+bool Shard::readFromClient(Client& client)
+{
+	LineBuffer& input = client.getInput();
+	int fd = client.getFd();
+
+	ssize_t n;
+	while (true)
+	{
+		size_t room = input.reserve();
+		n = read(fd, input.writePtr(), room);
+		if (n <= 0)
+			break;
+		input.commit(n);
+		metrics.add(id, Metrics::BYTES_READ, n);
+		processInput(client);
+	}
+	if (n == 0)
+	{
+		logger.log(Logger::INFO, Logger::CONN, "Client disconnected: fd = %d", fd);
+		disconnectClient(client);
+		return false;
+	}
+	else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+	{
+		// A reset from one peer is that client's problem, as on the
+		// io_uring path, not a reason to stop the server.
+		logger.log(Logger::WARN, Logger::IO, "Error reading from client: fd = %d: %s", fd, strerror(errno));
+		disconnectClient(client);
+		return false;
+	}
+	return true;
+}
+
+// Frames and parses every complete line the client has buffered on this
+// shard's thread, then runs them all under one lock hold; only command
+// execution is serialized. The views stay valid because nothing reads into
+// the buffer meanwhile. Logging each line is a DEBUG message, so it costs
+// one branch unless asked for. Capture records lines under the lock, in the
+// order the commands run.
+void Shard::processInput(Client& client)
+{
+	LineBuffer& input = client.getInput();
+	lineView line;
+
+	batch.clear();
+	while (input.nextLine(line))
+	{
+		batch.resize(batch.size() + 1);
+		parsedLine& parsed = batch.back();
+		parsed.line = line;
+		parsed.valid = Parser::parse(line.data, line.size, parsed.msg);
+		logger.log(Logger::DEBUG, Logger::MESSAGE, "IRC message from {%d} : [%.*s]", client.getFd(), static_cast<int>(line.size), line.data);
+	}
+	if (batch.empty())
+		return;
+
+	StateGuard guard(server, this);
+	Capture *capture = server.getCapture();
+	for (size_t i = 0; i < batch.size(); ++i)
+	{
+		const parsedLine& parsed = batch[i];
+		if (capture != NULL)
+			capture->received(client.getId(), parsed.line);
+		server.dispatchMessage(client, parsed.valid ? &parsed.msg : NULL, parsed.line.size);
+	}
+}
+
+void Shard::disconnectClient(Client& client)
+{
+	int fd = client.getFd();
+
+#ifdef __linux__
+	if (uring != NULL)
+		slots[fd].retainedOffset = client.takeSendQueue(slots[fd].retained);
+#endif
+
+	{
+		StateGuard guard(server, this);
+		server.unregisterClient(client);
+	}
+	local[fd] = NULL;
+
+#ifdef __linux__
+	if (uring != NULL)
+	{
+		retireFd(fd);
+		return;
+	}
+#endif
+	reactor->remove(fd);
+	close(fd);
+}
+
+void Shard::closeClient(Client& client, const std::string& reason)
+{
+	if (client.isClosing())
+		return;
+	client.markForClose(reason);
+	pendingClose.push_back(client.getFd());
+}
+
+// Appends to a client owned by this shard. Must run on the shard's thread.
+void Shard::deliver(Client& client, const MessageBuffer& msg)
+{
+	if (client.isClosing())
+		return;
+
+	if (client.getSendQueueSize() + msg.size() > sendqLimit)
+	{
+		closeClient(client, "SendQ exceeded");
+		return;
+	}
+
+	client.queueMessage(msg);
+	if (!client.getFlushPending())
+	{
+		client.setFlushPending(true);
+		pendingFlush.push_back(client.getFd());
+	}
+}
+
+// Hands a message to this shard from any thread. The client id guards
+// against the fd having been closed and reused before the shard gets to it.
+void Shard::post(int fd, unsigned long clientId, const MessageBuffer& msg)
+{
+	outboundMessage out;
+	out.fd = fd;
+	out.clientId = clientId;
+	out.data = msg;
+	inbox.push(out);
+	wake();
+}
+
+void Shard::drainInbox()
+{
+	outboundMessage msg;
+
+	while (inbox.pop(msg))
+	{
+		Client *client = findLocal(msg.fd);
+		if (client != NULL && client->getId() == msg.clientId)
+			deliver(*client, msg.data);
+	}
+}
+
+// Writes what the socket takes and only asks the reactor for writability
+// while something is left over.
+void Shard::flushClient(Client& client)
+{
+#ifdef __linux__
+	if (uring != NULL)
+	{
+		submitSends(client);
+		return;
+	}
+#endif
+
+	size_t queued = client.getSendQueueSize();
+	bool written = client.flushSendQueue();
+	metrics.add(id, Metrics::BYTES_WRITTEN, queued - client.getSendQueueSize());
+	if (!written)
+	{
+		closeClient(client, "Write error");
+		return;
+	}
+
+	bool wantsWrite = client.hasPendingOutput();
+	if (wantsWrite == client.getWantsWrite())
+		return;
+
+	int events = Reactor::READ | Reactor::EDGE;
+	if (wantsWrite)
+		events |= Reactor::WRITE;
+	reactor->modify(client.getFd(), events, &client);
+	client.setWantsWrite(wantsWrite);
+}
+
+// Runs once per loop iteration: drops clients marked for closing (which may
+// queue QUIT notices for others) and then flushes every touched send queue.
+void Shard::processPendingOutput()
+{
+	while (!pendingClose.empty() || !pendingFlush.empty())
+	{
+		while (!pendingClose.empty())
+		{
+			int fd = pendingClose.back();
+			pendingClose.pop_back();
+
+			Client *client = findLocal(fd);
+			if (client == NULL || !client->isClosing())
+				continue;
+
+			std::string err = "ERROR :Closing Link: " + client->getHostname() + " (" + client->getCloseReason() + ")\r\n";
+			client->queueMessage(MessageBuffer(err));
+#ifdef __linux__
+			if (uring == NULL || slots[fd].sends == 0)
+#endif
+			{
+				size_t queued = client->getSendQueueSize();
+				client->flushSendQueue();
+				metrics.add(id, Metrics::BYTES_WRITTEN, queued - client->getSendQueueSize());
+			}
+			logger.log(Logger::INFO, Logger::CONN, "Client dropped: fd = %d (%s)", fd, client->getCloseReason().c_str());
+			disconnectClient(*client);
+		}
+
+		std::vector<int> flushing;
+		flushing.swap(pendingFlush);
+		for (size_t i = 0; i < flushing.size(); ++i)
+		{
+			Client *client = findLocal(flushing[i]);
+			if (client == NULL)
+				continue;
+			client->setFlushPending(false);
+			if (!client->isClosing())
+				flushClient(*client);
+		}
+	}
+}
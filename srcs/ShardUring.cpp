@@ -0,0 +1,339 @@
+#include "Shard.hpp"
+#include "Server.hpp"
+
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// Longest chain of linked sends submitted for one client at a time.
+static const int SEND_CHAIN = 16;
+
+// How long a dropped client's remaining output may take before the socket is
+// shut down under it. Every linger timeout points at this one timespec, so
+// its address stays valid however long the SQE waits to be submitted.
+static const struct __kernel_timespec LINGER = { 5, 0 };
+
+enum uringOp
+{
+	OP_ACCEPT = 1,
+	OP_WAKE,
+	OP_RECV,
+	OP_SEND,
+	OP_LINGER
+};
+
+// user_data layout: operation (8 bits), fd (24 bits), low 32 bits of the
+// client id. The id tells a completion for a previous owner of the fd apart.
+static unsigned long long packUserData(uringOp op, int fd, unsigned long clientId)
+{
+	return (static_cast<unsigned long long>(op) << 56)
+		| (static_cast<unsigned long long>(fd & 0xffffff) << 32)
+		| (clientId & 0xffffffffUL);
+}
+
+static uringOp userDataOp(unsigned long long data)
+{
+	return static_cast<uringOp>(data >> 56);
+}
+
+static int userDataFd(unsigned long long data)
+{
+	return static_cast<int>((data >> 32) & 0xffffff);
+}
+
+static unsigned long userDataId(unsigned long long data)
+{
+	return static_cast<unsigned long>(data & 0xffffffffULL);
+}
+
+static void consumeRetained(uringSlot& slot, size_t n)
+{
+	while (n > 0 && !slot.retained.empty())
+	{
+		size_t left = slot.retained.front().size() - slot.retainedOffset;
+		if (n < left)
+		{
+			slot.retainedOffset += n;
+			return;
+		}
+		n -= left;
+		slot.retained.pop_front();
+		slot.retainedOffset = 0;
+	}
+}
+
+// Queues count sends as one linked chain so they complete in order.
+static void queueSendChain(Uring& uring, int fd, unsigned long clientId, const struct iovec *iov, int count)
+{
+	uring.reserve(count);
+	for (int i = 0; i < count; i++)
+	{
+		struct io_uring_sqe *sqe = uring.getSqe();
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<unsigned long>(iov[i].iov_base);
+		sqe->len = iov[i].iov_len;
+		sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+		if (i + 1 < count)
+			sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = packUserData(OP_SEND, fd, clientId);
+	}
+}
+
+// Accepting, receiving and sending are all completions here: one multishot
+// accept on the listener, one multishot recv per client drawing from the
+// registered buffer ring, and at most one chain of linked sends per client.
+void Shard::runUring()
+{
+	armAccept();
+	armWake();
+
+	struct io_uring_cqe cqe;
+	while (!server.isStopping())
+	{
+		unsigned long long waited = tracer.enabled() ? Metrics::nowNs() : 0;
+		uring->submit(true);
+		unsigned long long start = Metrics::nowNs();
+		while (uring->nextCompletion(cqe))
+			handleCompletion(cqe);
+		unsigned long long flushed = tracer.enabled() ? Metrics::nowNs() : 0;
+		processPendingOutput();
+		endIteration(waited, start, flushed);
+	}
+}
+
+void Shard::armAccept()
+{
+	struct io_uring_sqe *sqe = uring->getSqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listen_fd;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = packUserData(OP_ACCEPT, listen_fd, 0);
+}
+
+void Shard::armWake()
+{
+	struct io_uring_sqe *sqe = uring->getSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = wakeFds[0];
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = packUserData(OP_WAKE, wakeFds[0], 0);
+}
+
+void Shard::armRecv(Client& client)
+{
+	int fd = client.getFd();
+	struct io_uring_sqe *sqe = uring->getSqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = Uring::BUFFER_GROUP;
+	sqe->user_data = packUserData(OP_RECV, fd, client.getId());
+	slots[fd].inflight++;
+}
+
+// Buffers stay queued until their completion arrives; a client never has
+// more than one chain in flight.
+void Shard::submitSends(Client& client)
+{
+	int fd = client.getFd();
+	uringSlot& slot = slots[fd];
+	if (slot.sends > 0)
+		return;
+
+	struct iovec iov[SEND_CHAIN];
+	int count = client.peekSendQueue(iov, SEND_CHAIN);
+	queueSendChain(*uring, fd, client.getId(), iov, count);
+	slot.sends += count;
+	slot.inflight += count;
+}
+
+void Shard::handleCompletion(const struct io_uring_cqe& cqe)
+{
+	int fd = userDataFd(cqe.user_data);
+	unsigned long clientId = userDataId(cqe.user_data);
+
+	switch (userDataOp(cqe.user_data))
+	{
+		case OP_ACCEPT:
+			if (cqe.res >= 0)
+				addClient(cqe.res);
+			else if (cqe.res == -EMFILE || cqe.res == -ENFILE)
+				shedConnection();
+			else
+				logger.log(Logger::ERROR, Logger::CONN, "Accept failed: %s", strerror(-cqe.res));
+			if (!(cqe.flags & IORING_CQE_F_MORE))
+				armAccept();
+			break;
+		case OP_WAKE:
+			handleWake();
+			if (!(cqe.flags & IORING_CQE_F_MORE))
+				armWake();
+			break;
+		case OP_RECV:
+			onRecv(fd, clientId, cqe);
+			break;
+		case OP_SEND:
+			onSend(fd, clientId, cqe.res);
+			break;
+		case OP_LINGER:
+			if (static_cast<size_t>(fd) < slots.size() && slots[fd].retired && (slots[fd].clientId & 0xffffffffUL) == clientId)
+				shutdown(fd, SHUT_RDWR);
+			break;
+	}
+}
+
+Client *Shard::findUringClient(int fd, unsigned long clientId) const
+{
+	Client *client = findLocal(fd);
+	if (client == NULL || (client->getId() & 0xffffffffUL) != clientId)
+		return NULL;
+	return client;
+}
+
+void Shard::onRecv(int fd, unsigned long clientId, const struct io_uring_cqe& cqe)
+{
+	bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+	if (!more)
+		slots[fd].inflight--;
+
+	Client *client = findUringClient(fd, clientId);
+	if (cqe.flags & IORING_CQE_F_BUFFER)
+	{
+		unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+		if (client != NULL && !client->isClosing() && cqe.res > 0)
+		{
+			LineBuffer& input = client->getInput();
+			const char *data = uring->buffer(bid);
+			size_t left = cqe.res;
+			metrics.add(id, Metrics::BYTES_READ, left);
+			while (left > 0)
+			{
+				size_t n = input.reserve();
+				if (n > left)
+					n = left;
+				std::memcpy(input.writePtr(), data, n);
+				input.commit(n);
+				data += n;
+				left -= n;
+				processInput(*client);
+			}
+		}
+		uring->recycle(bid);
+	}
+
+	if (client == NULL)
+	{
+		releaseRetired(fd);
+		return;
+	}
+	if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS))
+	{
+		if (!client->isClosing())
+		{
+			logger.log(Logger::INFO, Logger::CONN, "Client disconnected: fd = %d", fd);
+			disconnectClient(*client);
+		}
+		return;
+	}
+	if (!more && !client->isClosing())
+		armRecv(*client);
+}
+
+void Shard::onSend(int fd, unsigned long clientId, int res)
+{
+	uringSlot& slot = slots[fd];
+	slot.inflight--;
+	slot.sends--;
+
+	size_t sent = res > 0 ? res : 0;
+	if (res < 0 && res != -ECANCELED)
+		slot.failed = true;
+	metrics.add(id, Metrics::BYTES_WRITTEN, sent);
+
+	Client *client = findUringClient(fd, clientId);
+	if (client == NULL)
+	{
+		consumeRetained(slot, sent);
+		if (slot.sends == 0)
+			submitRetained(fd);
+		return;
+	}
+
+	client->consumeSendQueue(sent);
+	if (slot.sends > 0)
+		return;
+	if (slot.failed)
+	{
+		closeClient(*client, "Write error");
+		return;
+	}
+	if (client->hasPendingOutput() && !client->isClosing())
+		submitSends(*client);
+}
+
+// The client is gone but the kernel may still hold its fd and buffers. Stop
+// receiving, let queued output (ending in the ERROR line) drain for a while,
+// and close once nothing refers to the descriptor any more.
+void Shard::retireFd(int fd)
+{
+	uringSlot& slot = slots[fd];
+	slot.retired = true;
+	shutdown(fd, SHUT_RD);
+
+	if (!slot.retained.empty() || slot.sends > 0)
+	{
+		struct io_uring_sqe *sqe = uring->getSqe();
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->addr = reinterpret_cast<unsigned long>(&LINGER);
+		sqe->len = 1;
+		sqe->user_data = packUserData(OP_LINGER, fd, slot.clientId);
+	}
+	if (slot.sends == 0)
+		submitRetained(fd);
+}
+
+// Sends the next part of a dropped client's leftover output, or closes the
+// descriptor once there is nothing left to send.
+void Shard::submitRetained(int fd)
+{
+	uringSlot& slot = slots[fd];
+	if (slot.failed)
+		slot.retained.clear();
+	if (slot.retained.empty())
+	{
+		releaseRetired(fd);
+		return;
+	}
+
+	struct iovec iov[SEND_CHAIN];
+	int count = 0;
+	for (std::deque<MessageBuffer>::const_iterator it = slot.retained.begin(); it != slot.retained.end() && count < SEND_CHAIN; ++it, ++count)
+	{
+		size_t skip = (count == 0) ? slot.retainedOffset : 0;
+		iov[count].iov_base = const_cast<char *>(it->data() + skip);
+		iov[count].iov_len = it->size() - skip;
+	}
+	queueSendChain(*uring, fd, slot.clientId, iov, count);
+	slot.sends += count;
+	slot.inflight += count;
+}
+
+void Shard::releaseRetired(int fd)
+{
+	uringSlot& slot = slots[fd];
+	if (!slot.retired || slot.inflight > 0 || slot.sends > 0 || !slot.retained.empty())
+		return;
+	slot.retired = false;
+	close(fd);
+}
+
+#endif
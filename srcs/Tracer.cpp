@@ -0,0 +1,202 @@
+#include "Tracer.hpp"
+#include "Metrics.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+int Tracer::dumpRequested = 0;
+
+Tracer::Tracer(const serverConfig& config, Logger& logger)
+	: logger(logger), capacity(config.traceEvents), path(config.traceFile), origin(Metrics::nowNs()), writerStarted(false), writing(0)
+{
+	if (capacity == 0)
+		return;
+	rings.resize(config.threads);
+	for (size_t i = 0; i < rings.size(); i++)
+	{
+		rings[i].events.resize(capacity);
+		rings[i].next = 0;
+	}
+}
+
+void Tracer::record(int thread, const char *name, unsigned long long begin, unsigned long long end,
+	int fd, const char *channel, size_t channelLen, size_t fanout)
+{
+	ring& r = rings[thread];
+	unsigned long index = r.next;
+	event& e = r.events[index % capacity];
+
+	e.begin = begin;
+	e.end = end;
+	e.name = name;
+	e.fd = fd;
+	e.fanout = fanout;
+	if (channelLen >= CHANNEL_SIZE)
+		channelLen = CHANNEL_SIZE - 1;
+	if (channelLen != 0)
+		std::memcpy(e.channel, channel, channelLen);
+	e.channel[channelLen] = '\0';
+	__atomic_store_n(&r.next, index + 1, __ATOMIC_RELEASE);
+}
+
+// A dump still being written is finished before the rings go away.
+Tracer::~Tracer()
+{
+	if (writerStarted)
+		pthread_join(writer, NULL);
+}
+
+void Tracer::requestDump()
+{
+	__atomic_store_n(&dumpRequested, 1, __ATOMIC_RELAXED);
+}
+
+bool Tracer::takeDumpRequest()
+{
+	return __atomic_load_n(&dumpRequested, __ATOMIC_RELAXED) != 0 && __atomic_exchange_n(&dumpRequested, 0, __ATOMIC_ACQ_REL) != 0;
+}
+
+// Channel names come from clients, so they are escaped for JSON.
+static void appendEscaped(std::string& out, const char *text)
+{
+	for (; *text != '\0'; text++)
+	{
+		unsigned char c = *text;
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if (c < 0x20)
+		{
+			char hex[8];
+			std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+			out += hex;
+		}
+		else
+			out += c;
+	}
+}
+
+// Copies every ring and hands the copies to the writer thread. Callers hold
+// the state lock, so only one dump is set up at a time; one that comes while
+// the previous file is still being written is refused.
+bool Tracer::dump(std::string& result)
+{
+	if (capacity == 0)
+	{
+		result = "tracing is off, start the server with --trace=n";
+		return false;
+	}
+	if (__atomic_load_n(&writing, __ATOMIC_ACQUIRE))
+	{
+		result = "a trace is still being written to " + path;
+		return false;
+	}
+	if (writerStarted)
+	{
+		pthread_join(writer, NULL);
+		writerStarted = false;
+	}
+
+	copies.resize(rings.size());
+	unsigned long total = 0;
+	for (size_t t = 0; t < rings.size(); t++)
+	{
+		// Events before last were complete when the copy started. The one at
+		// index after may have been in the middle of being written over the
+		// slot of after - capacity, so only the capacity - 1 before it are
+		// sure to be whole.
+		copy& c = copies[t];
+		c.events.resize(capacity);
+		c.last = __atomic_load_n(&rings[t].next, __ATOMIC_ACQUIRE);
+		std::memcpy(&c.events[0], &rings[t].events[0], capacity * sizeof(event));
+		unsigned long after = __atomic_load_n(&rings[t].next, __ATOMIC_ACQUIRE);
+		c.first = after + 1 > capacity ? after + 1 - capacity : 0;
+		if (c.first < c.last)
+			total += c.last - c.first;
+	}
+
+	__atomic_store_n(&writing, 1, __ATOMIC_RELEASE);
+	if (pthread_create(&writer, NULL, &Tracer::writerMain, this) != 0)
+	{
+		__atomic_store_n(&writing, 0, __ATOMIC_RELEASE);
+		result = "could not start the trace writer thread";
+		return false;
+	}
+	writerStarted = true;
+
+	std::ostringstream out;
+	out << "writing " << total << " events to " << path;
+	result = out.str();
+	return true;
+}
+
+void *Tracer::writerMain(void *arg)
+{
+	Tracer *tracer = static_cast<Tracer *>(arg);
+	tracer->write();
+	__atomic_store_n(&tracer->writing, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+// Renders the copies and writes the trace file, then logs the outcome.
+void Tracer::write()
+{
+	std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	char text[160];
+	unsigned long written = 0;
+
+	for (size_t t = 0; t < copies.size(); t++)
+	{
+		std::snprintf(text, sizeof(text), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"shard %lu\"}}",
+			t == 0 ? "" : ",", static_cast<unsigned long>(t), static_cast<unsigned long>(t));
+		out += text;
+
+		const copy& c = copies[t];
+		for (unsigned long i = c.first; i < c.last; i++)
+		{
+			const event& e = c.events[i % capacity];
+			std::snprintf(text, sizeof(text), ",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f",
+				e.name, e.fd < 0 ? "loop" : "command", static_cast<unsigned long>(t),
+				(e.begin - origin) / 1000.0, (e.end - e.begin) / 1000.0);
+			out += text;
+			if (e.fd >= 0)
+			{
+				std::snprintf(text, sizeof(text), ",\"args\":{\"fd\":%d,\"fanout\":%u,\"channel\":\"", e.fd, e.fanout);
+				out += text;
+				appendEscaped(out, e.channel);
+				out += "\"}";
+			}
+			out += '}';
+			written++;
+		}
+	}
+	out += "]}\n";
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+	{
+		logger.log(Logger::WARN, Logger::SERVER, "trace dump failed: could not open %s: %s", path.c_str(), strerror(errno));
+		return;
+	}
+	size_t done = 0;
+	while (done < out.size())
+	{
+		ssize_t n = ::write(fd, out.data() + done, out.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			logger.log(Logger::WARN, Logger::SERVER, "trace dump failed: could not write %s: %s", path.c_str(), strerror(errno));
+			close(fd);
+			return;
+		}
+		done += n;
+	}
+	close(fd);
+	logger.log(Logger::INFO, Logger::SERVER, "trace: %lu events written to %s", written, path.c_str());
+}
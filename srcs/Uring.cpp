@@ -0,0 +1,261 @@
+#include "Uring.hpp"
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+#define RED "\033[1;31m"
+#define RESET "\033[0m"
+
+static int uringSetup(unsigned entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, void *arg, unsigned count)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static void *mapRing(int fd, size_t size, unsigned long long offset)
+{
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+Uring::Uring(unsigned entries, unsigned bufCount, unsigned bufSize)
+	: ringFd(-1), sqRing(NULL), sqRingSize(0), cqRing(NULL), cqRingSize(0), sqes(NULL), sqesSize(0),
+	localTail(0), submitted(0), bufRing(NULL), bufRingSize(0), bufPool(NULL), bufCount(bufCount), bufSize(bufSize), bufTail(0)
+{
+	try
+	{
+		setupRings(entries);
+		setupBuffers();
+	}
+	catch (...)
+	{
+		release();
+		throw;
+	}
+}
+
+Uring::~Uring()
+{
+	release();
+}
+
+void Uring::release()
+{
+	if (bufRing != NULL)
+		munmap(bufRing, bufRingSize);
+	std::free(bufPool);
+	if (sqes != NULL)
+		munmap(sqes, sqesSize);
+	if (cqRing != NULL && cqRing != sqRing)
+		munmap(cqRing, cqRingSize);
+	if (sqRing != NULL)
+		munmap(sqRing, sqRingSize);
+	if (ringFd != -1)
+		close(ringFd);
+	bufRing = NULL;
+	bufPool = NULL;
+	sqes = NULL;
+	cqRing = NULL;
+	sqRing = NULL;
+	ringFd = -1;
+}
+
+void Uring::setupRings(unsigned entries)
+{
+	struct io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 4;
+
+	ringFd = uringSetup(entries, &params);
+	if (ringFd < 0)
+		throw std::runtime_error(RED"Error: io_uring_setup failed " + std::string(strerror(errno)) + RESET);
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+		throw std::runtime_error(RED"Error: io_uring lacks IORING_FEAT_SINGLE_MMAP" RESET);
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (cqRingSize > sqRingSize)
+		sqRingSize = cqRingSize;
+	cqRingSize = sqRingSize;
+
+	sqRing = mapRing(ringFd, sqRingSize, IORING_OFF_SQ_RING);
+	if (sqRing == NULL)
+		throw std::runtime_error(RED"Error: io_uring ring mmap failed " + std::string(strerror(errno)) + RESET);
+	cqRing = sqRing;
+
+	sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = static_cast<struct io_uring_sqe *>(mapRing(ringFd, sqesSize, IORING_OFF_SQES));
+	if (sqes == NULL)
+		throw std::runtime_error(RED"Error: io_uring sqe mmap failed " + std::string(strerror(errno)) + RESET);
+
+	char *sq = static_cast<char *>(sqRing);
+	sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+	sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+	sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+	sqFlags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+	sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+	sqEntries = params.sq_entries;
+
+	char *cq = static_cast<char *>(cqRing);
+	cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+	cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+	localTail = *sqTail;
+	submitted = localTail;
+}
+
+// Registers bufCount receive buffers of bufSize bytes as buffer group 0.
+void Uring::setupBuffers()
+{
+	bufRingSize = bufCount * sizeof(struct io_uring_buf);
+	void *ring = mmap(NULL, bufRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (ring == MAP_FAILED)
+		throw std::runtime_error(RED"Error: buffer ring mmap failed " + std::string(strerror(errno)) + RESET);
+	bufRing = static_cast<struct io_uring_buf *>(ring);
+
+	bufPool = static_cast<char *>(std::malloc(static_cast<size_t>(bufCount) * bufSize));
+	if (bufPool == NULL)
+		throw std::runtime_error(RED"Error: could not allocate receive buffers" RESET);
+
+	struct io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<unsigned long>(bufRing);
+	reg.ring_entries = bufCount;
+	reg.bgid = BUFFER_GROUP;
+	if (uringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		throw std::runtime_error(RED"Error: could not register buffer ring " + std::string(strerror(errno)) + RESET);
+
+	for (unsigned bid = 0; bid < bufCount; bid++)
+		recycle(bid);
+}
+
+// The ring tail shares storage with the reserved field of the first entry.
+static unsigned short *bufRingTail(struct io_uring_buf *ring)
+{
+	return &ring[0].resv;
+}
+
+char *Uring::buffer(unsigned bid) const
+{
+	return bufPool + static_cast<size_t>(bid) * bufSize;
+}
+
+void Uring::recycle(unsigned bid)
+{
+	struct io_uring_buf *buf = &bufRing[bufTail & (bufCount - 1)];
+	buf->addr = reinterpret_cast<unsigned long>(buffer(bid));
+	buf->len = bufSize;
+	buf->bid = bid;
+	bufTail++;
+	__atomic_store_n(bufRingTail(bufRing), bufTail, __ATOMIC_RELEASE);
+}
+
+// Returns a zeroed SQE, submitting what is queued first if the ring is full.
+struct io_uring_sqe *Uring::getSqe()
+{
+	if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+		submit(false);
+
+	unsigned index = localTail & sqMask;
+	struct io_uring_sqe *sqe = &sqes[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	sqArray[index] = index;
+	localTail++;
+	return sqe;
+}
+
+// Makes sure the next count SQEs fit without an intermediate submit, so a
+// linked chain never gets split.
+void Uring::reserve(unsigned count)
+{
+	if (sqEntries - (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) < count)
+		submit(false);
+}
+
+// Completions that did not fit the CQ are held by the kernel until
+// io_uring_enter is asked for events; poll() keeps reporting the ring
+// readable meanwhile, so they must be flushed here.
+void Uring::submit(bool wait)
+{
+	__atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+
+	unsigned pending = localTail - submitted;
+	bool overflow = (__atomic_load_n(sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) != 0;
+	if (pending > 0 || overflow)
+	{
+		int ret = uringEnter(ringFd, pending, 0, overflow ? IORING_ENTER_GETEVENTS : 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				return;
+			throw std::runtime_error(RED"Error during io_uring_enter: " + std::string(strerror(errno)) + RESET);
+		}
+		submitted += ret;
+	}
+
+	if (!wait || *cqHead != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		return;
+	struct pollfd pfd;
+	pfd.fd = ringFd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+		throw std::runtime_error(RED"Error during poll: " + std::string(strerror(errno)) + RESET);
+}
+
+bool Uring::nextCompletion(struct io_uring_cqe& out)
+{
+	unsigned head = *cqHead;
+	if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		return false;
+	out = cqes[head & cqMask];
+	__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// Multishot recv needs Linux 6.0; anything older falls back to poll.
+bool Uring::isSupported()
+{
+	struct utsname name;
+	if (uname(&name) == -1)
+		return false;
+
+	char *end = NULL;
+	long major = std::strtol(name.release, &end, 10);
+	if (major < 6)
+		return false;
+
+	try
+	{
+		Uring probe(8, 8, 64);
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+	return true;
+}
+
+#endif
@@ -3,21 +3,20 @@
 
 void handleSignals(int signal)
 {
-	if (signal == SIGINT || signal == SIGTERM || signal == SIGQUIT)
-		throw std::runtime_error(RED"Server terminated by signal " + ft_itoa(signal) + RESET);
+	Server::notifySignal(signal);
 }
 
 int main(int ac, char **av)
 {
 	try
 	{
-		if (ac != 3)
-			throw std::invalid_argument(RED"Wrong inputs.\n" GREEN"Usage: " WHITE"\"" + std::string(av[0]) + "\" \"port\" \"password\"" RESET);
+		serverConfig config = Config::parse(ac, av);
 		signal(SIGINT, handleSignals);
 		signal(SIGTERM, handleSignals);
 		signal(SIGQUIT, handleSignals);
 		signal(SIGPIPE, SIG_IGN);
-		Server server(av[1], av[2]);
+		signal(SIGUSR1, handleSignals);
+		Server server(config);
 		server.run();
 		return (0);
 	}